@@ -1,4 +1,5 @@
-from ._simplex import Simplex
+from ._simplex import Sampler, Simplex, Storage, sample, write_binary_circuit
 
 
-__all__ = ("Simplex",)
+__all__ = (
+    "Sampler", "Simplex", "Storage", "sample", "write_binary_circuit")
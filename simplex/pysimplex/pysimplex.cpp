@@ -1,25 +1,62 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include <binary-circuit.hpp>
+#include <parse-stim.hpp>
 #include <simplex.hpp>
 
 #include <optional>
 #include <ostream>
 #include <sstream>
+#include <string>
+#include <vector>
 
 namespace py = pybind11;
 
+// One list of measurement results per shot
+static std::vector<std::vector<int>> to_rows(const shot_results& res) {
+  std::vector<std::vector<int>> rows(res.n_shots);
+  for (unsigned i = 0; i < res.n_shots; i++) {
+    rows[i].resize(res.n_meas);
+    for (unsigned k = 0; k < res.n_meas; k++) {
+      rows[i][k] = res.get(i, k);
+    }
+  }
+  return rows;
+}
+
 PYBIND11_MODULE(_simplex, m) {
+  py::enum_<storage>(m, "Storage",
+    "Storage scheme for the simulator's internal matrices")
+    .value("automatic", storage::automatic,
+        "Choose according to the build options and circuit")
+    .value("sparse", storage::sparse,
+        "Nonzero indices of each row in a balanced tree")
+    .value("flat", storage::flat,
+        "Nonzero indices of each row in a sorted array")
+    .value("hybrid", storage::hybrid,
+        "Each row a sorted array or a bitmap, according to its density")
+    .value("dense", storage::dense,
+        "One int per entry")
+    .value("packed", storage::packed,
+        "One bit per entry, in 64-bit words");
+
   py::class_<Simplex>(m, "Simplex",
     "Clifford circuit simulator")
-    .def(py::init<unsigned>(),
-        "Initialize a simulator with `n` qubits.",
-        py::arg("n"))
-    .def(py::init<char *, int>(),
-        "Initialize a simulator from a Stim-format file."
-        "\n\n",
-        "Accepts a file path (as a string), and optionally an RNG seed.",
-        py::arg("p"), py::arg("seed") = 0)
+    .def(py::init<unsigned, int, storage>(),
+        "Initialize a simulator with `n` qubits."
+        "\n\n"
+        "Optionally accepts an RNG seed and a storage scheme.",
+        py::arg("n"), py::arg("seed") = 0,
+        py::arg("storage") = storage::automatic)
+    .def(py::init<char *, int, storage>(),
+        "Initialize a simulator from a Stim-format or binary circuit file."
+        "\n\n"
+        "Accepts a file path (as a string), and optionally an RNG seed and a "
+        "storage scheme. By default the storage scheme is chosen according "
+        "to the circuit.",
+        py::arg("p"), py::arg("seed") = 0,
+        py::arg("storage") = storage::automatic)
     .def("__repr__",
         [](const Simplex& S) {
             std::stringstream ss;
@@ -105,5 +142,80 @@ PYBIND11_MODULE(_simplex, m) {
         "Global phase, in units of pi/4 (an integer in the range [0,8))")
     .def("is_deterministic",
         &Simplex::is_deterministic,
-        "Report whether all measurements are deterministic.");
+        "Report whether all measurements are deterministic.")
+    .def("sample_all_z",
+        [](const Simplex& S, unsigned shots, int seed) {
+            return to_rows(S.sample_all_z(shots, seed));
+        },
+        "Sample `shots` results of measuring every qubit in the Z basis, "
+        "without changing the state."
+        "\n\n"
+        "Returns one list of results per shot, indexed by qubit.",
+        py::arg("shots"), py::arg("seed") = 0)
+    .def("sample_all",
+        [](const Simplex& S, std::string bases, unsigned shots, int seed) {
+            return to_rows(S.sample_all(bases, shots, seed));
+        },
+        "Sample `shots` results of measuring every qubit j in the basis "
+        "`bases[j]` ('X', 'Y' or 'Z'), without changing the state."
+        "\n\n"
+        "Returns one list of results per shot, indexed by qubit.",
+        py::arg("bases"), py::arg("shots"), py::arg("seed") = 0);
+
+  py::class_<Sampler>(m, "Sampler",
+    "Circuit compiled for fast sampling")
+    .def(py::init<char *, storage>(),
+        "Compile the circuit in a Stim-format file."
+        "\n\n"
+        "The circuit is simulated once, expressing each measurement result "
+        "as an affine function of the random measurement outcomes (coins). "
+        "Optionally accepts a storage scheme for the internal matrices used "
+        "while compiling.",
+        py::arg("p"), py::arg("storage") = storage::automatic)
+    .def_property_readonly("n_meas",
+        &Sampler::n_meas,
+        "Number of measurements in the circuit")
+    .def_property_readonly("n_coins",
+        &Sampler::n_coins,
+        "Number of random measurements in the circuit")
+    .def("sample",
+        [](const Sampler& C, unsigned shots, int seed) {
+            shot_results res;
+            {
+              py::gil_scoped_release release;
+              res = C.sample(shots, seed);
+            }
+            return to_rows(res);
+        },
+        "Sample `shots` shots of the circuit."
+        "\n\n"
+        "Returns one list of measurement results per shot, in circuit order.",
+        py::arg("shots"), py::arg("seed") = 0);
+
+  m.def("sample",
+    [](char *p, unsigned shots, int seed, unsigned threads, storage s) {
+        const instrs is = parse_file(p);
+        shot_results res;
+        {
+          py::gil_scoped_release release;
+          res = Simplex::sample(is, shots, seed, threads, s);
+        }
+        return to_rows(res);
+    },
+    "Simulate many shots of the circuit in a Stim-format file."
+    "\n\n"
+    "The file is parsed once and the shots are shared between `threads` "
+    "threads (by default, one per hardware thread). Returns one list of "
+    "measurement results per shot, in circuit order. The results depend on "
+    "the seed but not on the number of threads.",
+    py::arg("p"), py::arg("shots"), py::arg("seed") = 0,
+    py::arg("threads") = 0, py::arg("storage") = storage::automatic);
+
+  m.def("write_binary_circuit",
+    [](char *p, char *out) { write_binary_circuit(parse_file(p), out); },
+    "Convert a Stim-format file to the binary circuit format."
+    "\n\n"
+    "`Simplex`, `Sampler` and `sample` accept either format; a binary "
+    "circuit is loaded without parsing.",
+    py::arg("p"), py::arg("out"));
 }
@@ -1,159 +1,541 @@
 #include "A_matrix.hpp"
+#include "bits.hpp"
+#include "cow.hpp"
+#include "hybrid_set.hpp"
+#include "node_pool.hpp"
+#include "sorted.hpp"
 #include <algorithm>
-#include <iostream>
+#include <bit>
+#include <cstdint>
+#include <iterator>
 #include <memory>
+#include <memory_resource>
 #include <set>
+#include <span>
+#include <variant>
 #include <vector>
 
-#if defined (SIMPLEX_DENSE)
-
-struct A_matrix::impl {
-  impl(unsigned n) : n(n), r(0), data(n, std::vector<int>(n+1, 0)) {}
+// Bit-packed dense storage
+struct A_packed {
+  // Each row is padded to a whole number of cache lines.
+  A_packed(unsigned n)
+    : n(n), hw(0), stride((words_for(n + 1) + 7) & ~std::size_t(7)),
+    data(n * stride, 0), weight(n, 0), mask(stride, 0) {}
 
   /* Data */
 
   unsigned n;
-  unsigned r;
-  std::vector<std::vector<int>> data;
+  unsigned hw; // columns hw and above have never been used
+  std::size_t stride; // words per row
+  // Row j occupies words [j * stride, (j + 1) * stride). Unused columns are
+  // always zero.
+  std::vector<uint64_t, aligned_allocator<uint64_t>> data;
+  // Number of ones in each row
+  std::vector<unsigned> weight;
+  // Scratch space for add_col; all zero between calls
+  std::vector<uint64_t, aligned_allocator<uint64_t>> mask;
 
   /* Methods */
 
-  int entry(unsigned j, unsigned h) const { return data[j][h]; }
+  uint64_t* row(unsigned j) { return data.data() + j * stride; }
+  const uint64_t* row(unsigned j) const { return data.data() + j * stride; }
 
-  void add_col(unsigned h, unsigned k) {
+  int entry(unsigned j, unsigned h) const { return get_bit(row(j), h); }
+
+  void add_col(std::span<const unsigned> H, unsigned c) {
+    // Every row with a 1 in column c is XORed with the mask of H:
+    uint64_t* m = mask.data();
+    for (unsigned h : H) {
+      set_bit(m, h);
+    }
+    const std::size_t nw = words_for(hw);
     for (unsigned j = 0; j < n; j++) {
-      data[j][h] ^= data[j][k];
+      uint64_t* A_j = row(j);
+      if (get_bit(A_j, c)) {
+        unsigned wt = 0;
+        for (std::size_t w = 0; w < nw; w++) {
+          A_j[w] ^= m[w];
+          wt += std::popcount(A_j[w]);
+        }
+        weight[j] = wt;
+      }
+    }
+    for (unsigned h : H) {
+      clear_bit(m, h);
     }
   }
 
   void add_row(unsigned j, unsigned k) {
-    for (unsigned h = 0; h < r; h++) {
-      data[j][h] ^= data[k][h];
+    uint64_t* A_j = row(j);
+    const uint64_t* A_k = row(k);
+    const std::size_t nw = words_for(hw);
+    unsigned c = 0;
+    for (std::size_t w = 0; w < nw; w++) {
+      A_j[w] ^= A_k[w];
+      c += std::popcount(A_j[w]);
+    }
+    weight[j] = c;
+  }
+
+  void xor_row_into(unsigned j, uint64_t* v) const {
+    const uint64_t* A_j = row(j);
+    const std::size_t nw = words_for(hw);
+    for (std::size_t w = 0; w < nw; w++) {
+      v[w] ^= A_j[w];
+    }
+  }
+
+  void xor_col_into(unsigned h, uint64_t* v) const {
+    for (unsigned j = 0; j < n; j++) {
+      v[j / word_bits] ^= uint64_t(get_bit(row(j), h)) << (j % word_bits);
     }
   }
 
   unsigned row_weight(unsigned j) const {
+    return weight[j];
+  }
+
+  unsigned col_weight(unsigned h) const {
     unsigned c = 0;
-    for (unsigned h = 0; h < r; h++) {
-      if (data[j][h]) c++;
+    for (unsigned j = 0; j < n; j++) {
+      c += get_bit(row(j), h);
     }
     return c;
   }
 
+  void set_basis_col(unsigned j, unsigned h) {
+    uint64_t* A_j = row(j);
+    std::fill(A_j, A_j + words_for(hw), 0);
+    set_bit(A_j, h);
+    weight[j] = 1;
+    hw = std::max(hw, h + 1);
+  }
+
+  void rows_where_one(unsigned h, std::vector<unsigned>& J) const {
+    J.clear();
+    for (unsigned j = 0; j < n; j++) {
+      if (get_bit(row(j), h)) {
+        J.push_back(j);
+      }
+    }
+  }
+
+  void cols_where_one(unsigned j, std::vector<unsigned>& H) const {
+    H.clear();
+    for_each_set_bit(row(j), words_for(hw), [&](unsigned h) {
+      H.push_back(h);
+    });
+  }
+
+  void cols_where_one(
+    unsigned j, unsigned k, std::vector<unsigned>& H) const
+  {
+    const uint64_t* A_j = row(j);
+    const uint64_t* A_k = row(k);
+    const std::size_t nw = words_for(hw);
+    H.clear();
+    for (std::size_t w = 0; w < nw; w++) {
+      const uint64_t x = A_j[w] & A_k[w];
+      for_each_set_bit(&x, 1, [&](unsigned h) {
+        H.push_back(w * word_bits + h);
+      });
+    }
+  }
+
+  void drop_col(unsigned h) {
+    for (unsigned j = 0; j < n; j++) {
+      uint64_t* A_j = row(j);
+      if (get_bit(A_j, h)) {
+        clear_bit(A_j, h);
+        weight[j]--;
+      }
+    }
+  }
+
+  void grow(unsigned n1) {
+    const std::size_t stride1 = (words_for(n1 + 1) + 7) & ~std::size_t(7);
+    if (stride1 != stride) {
+      std::vector<uint64_t, aligned_allocator<uint64_t>> data1(
+        n1 * stride1, 0);
+      for (unsigned j = 0; j < n; j++) {
+        std::copy(row(j), row(j) + stride, data1.data() + j * stride1);
+      }
+      data.swap(data1);
+      stride = stride1;
+      mask.assign(stride, 0);
+    } else {
+      data.resize(n1 * stride, 0);
+    }
+    weight.resize(n1, 0);
+    n = n1;
+  }
+};
+
+// Sparse storage in sorted vectors
+struct A_flat {
+  A_flat(unsigned n) : n(n), hw(0), rows(n), cols(n+1) {}
+
+  /* Data */
+
+  unsigned n;
+  unsigned hw; // columns hw and above have never been used
+  // Sorted indices of the nonzero entries in each row and column, shared
+  // with copies a block at a time
+  cow_vector<std::vector<uint32_t>> rows;
+  cow_vector<std::vector<uint32_t>> cols;
+  // Scratch space for merges
+  std::vector<uint32_t> tmp;
+
+  /* Methods */
+
+  int entry(unsigned j, unsigned h) const {
+    return sorted_contains(rows[j], uint32_t(h));
+  }
+
+  void add_col(std::span<const unsigned> H, unsigned c) {
+    // The entries that change are those in rows where column c is 1:
+    for (uint32_t j : cols[c]) {
+      sorted_xor(rows[j], H, tmp);
+    }
+    for (uint32_t h : H) {
+      sorted_xor(cols[h], cols[c], tmp);
+    }
+  }
+
+  void add_row(unsigned j, unsigned k) {
+    for (uint32_t h : rows[k]) {
+      sorted_toggle(cols[h], uint32_t(j));
+    }
+    sorted_xor(rows[j], rows[k], tmp);
+  }
+
+  void xor_row_into(unsigned j, uint64_t* v) const {
+    for (uint32_t h : rows[j]) {
+      flip_bit(v, h);
+    }
+  }
+
+  void xor_col_into(unsigned h, uint64_t* v) const {
+    for (uint32_t j : cols[h]) {
+      flip_bit(v, j);
+    }
+  }
+
+  unsigned row_weight(unsigned j) const {
+    return rows[j].size();
+  }
+
   unsigned col_weight(unsigned h) const {
-    unsigned c = 0;
+    return cols[h].size();
+  }
+
+  void set_basis_col(unsigned j, unsigned h) {
+    for (uint32_t k : rows[j]) {
+      sorted_erase(cols[k], uint32_t(j));
+    }
+    rows[j].clear();
+    rows[j].push_back(h);
+    cols[h].push_back(j); // column h is empty
+    hw = std::max(hw, h + 1);
+  }
+
+  void rows_where_one(unsigned h, std::vector<unsigned>& J) const {
+    J.assign(cols[h].begin(), cols[h].end());
+  }
+
+  void cols_where_one(unsigned j, std::vector<unsigned>& H) const {
+    H.assign(rows[j].begin(), rows[j].end());
+  }
+
+  void cols_where_one(
+    unsigned j, unsigned k, std::vector<unsigned>& H) const
+  {
+    sorted_intersect(rows[j], rows[k], H);
+  }
+
+  void drop_col(unsigned h) {
+    for (uint32_t j : cols[h]) {
+      sorted_erase(rows[j], uint32_t(h));
+    }
+    cols[h].clear();
+  }
+
+  void grow(unsigned n1) {
+    rows.resize(n1);
+    cols.resize(n1 + 1);
+    n = n1;
+  }
+};
+
+// Per-row choice of sorted array or bitmap
+struct A_hybrid {
+  A_hybrid(unsigned n)
+    : n(n), hw(0), rows(n, hybrid_set(n+1)), cols(n+1, hybrid_set(n)) {}
+
+  /* Data */
+
+  unsigned n;
+  unsigned hw; // columns hw and above have never been used
+  // Nonzero entries in each row and column, shared with copies a block at a
+  // time
+  cow_vector<hybrid_set> rows;
+  cow_vector<hybrid_set> cols;
+  // Scratch space for merges
+  std::vector<unsigned> tmp;
+
+  /* Methods */
+
+  int entry(unsigned j, unsigned h) const {
+    return rows[j].contains(h);
+  }
+
+  void add_col(std::span<const unsigned> H, unsigned c) {
+    cols[c].for_each([&](unsigned j) { rows[j].xor_with(H, tmp); });
+    for (unsigned h : H) {
+      cols[h].xor_with(cols[c], tmp);
+    }
+  }
+
+  void add_row(unsigned j, unsigned k) {
+    rows[k].for_each([&](unsigned h) { cols[h].toggle(j); });
+    rows[j].xor_with(rows[k], tmp);
+  }
+
+  void xor_row_into(unsigned j, uint64_t* v) const {
+    rows[j].for_each([&](unsigned h) { flip_bit(v, h); });
+  }
+
+  void xor_col_into(unsigned h, uint64_t* v) const {
+    cols[h].for_each([&](unsigned j) { flip_bit(v, j); });
+  }
+
+  unsigned row_weight(unsigned j) const {
+    return rows[j].size();
+  }
+
+  unsigned col_weight(unsigned h) const {
+    return cols[h].size();
+  }
+
+  void set_basis_col(unsigned j, unsigned h) {
+    rows[j].for_each([&](unsigned k) { cols[k].erase(j); });
+    rows[j].clear();
+    rows[j].insert(h);
+    cols[h].insert(j);
+    hw = std::max(hw, h + 1);
+  }
+
+  void rows_where_one(unsigned h, std::vector<unsigned>& J) const {
+    J.clear();
+    cols[h].append_to(J);
+  }
+
+  void cols_where_one(unsigned j, std::vector<unsigned>& H) const {
+    H.clear();
+    rows[j].append_to(H);
+  }
+
+  void cols_where_one(
+    unsigned j, unsigned k, std::vector<unsigned>& H) const
+  {
+    intersect(rows[j], rows[k], H);
+  }
+
+  void drop_col(unsigned h) {
+    cols[h].for_each([&](unsigned j) { rows[j].erase(h); });
+    cols[h].clear();
+  }
+
+  void grow(unsigned n1) {
     for (unsigned j = 0; j < n; j++) {
-      if (data[j][h]) c++;
+      rows[j].grow(n1 + 1);
     }
-    return c;
+    for (unsigned h = 0; h <= n; h++) {
+      cols[h].grow(n1);
+    }
+    rows.resize(n1, hybrid_set(n1 + 1));
+    cols.resize(n1 + 1, hybrid_set(n1));
+    n = n1;
   }
+};
+
+// Dense storage
+struct A_dense {
+  A_dense(unsigned n)
+    : n(n), hw(0), data(n, std::vector<int>(n+1, 0)), weight(n, 0) {}
 
-  void swap_col(unsigned h) {
-    const unsigned r1 = r - 1;
+  /* Data */
+
+  unsigned n;
+  unsigned hw; // columns hw and above have never been used
+  // Unused columns are always zero.
+  std::vector<std::vector<int>> data;
+  // Number of ones in each row
+  std::vector<unsigned> weight;
+
+  /* Methods */
+
+  int entry(unsigned j, unsigned h) const { return data[j][h]; }
+
+  void add_col(std::span<const unsigned> H, unsigned c) {
     for (unsigned j = 0; j < n; j++) {
       std::vector<int>& A_j = data[j];
-      std::iter_swap(A_j.begin() + h, A_j.begin() + r1);
+      if (A_j[c]) {
+        for (unsigned h : H) {
+          weight[j] += A_j[h] ? -1 : 1;
+          A_j[h] ^= 1;
+        }
+      }
+    }
+  }
+
+  void add_row(unsigned j, unsigned k) {
+    unsigned c = 0;
+    for (unsigned h = 0; h < hw; h++) {
+      data[j][h] ^= data[k][h];
+      if (data[j][h]) c++;
+    }
+    weight[j] = c;
+  }
+
+  void xor_row_into(unsigned j, uint64_t* v) const {
+    const std::vector<int>& A_j = data[j];
+    for (unsigned h = 0; h < hw; h++) {
+      if (A_j[h]) flip_bit(v, h);
+    }
+  }
+
+  void xor_col_into(unsigned h, uint64_t* v) const {
+    for (unsigned j = 0; j < n; j++) {
+      if (data[j][h]) flip_bit(v, j);
+    }
+  }
+
+  unsigned row_weight(unsigned j) const {
+    return weight[j];
+  }
+
+  unsigned col_weight(unsigned h) const {
+    unsigned c = 0;
+    for (unsigned j = 0; j < n; j++) {
+      if (data[j][h]) c++;
     }
+    return c;
   }
 
-  void zero_append_basis_col(unsigned j) {
+  void set_basis_col(unsigned j, unsigned h) {
     std::vector<int>& A_j = data[j];
-    for (unsigned h = 0; h < r; h++) {
-      A_j[h] = 0;
+    for (unsigned k = 0; k < hw; k++) {
+      A_j[k] = 0;
     }
-    for (unsigned k = 0; k < n; k++) {
-      data[k][r] = 0;
+    A_j[h] = 1;
+    weight[j] = 1;
+    hw = std::max(hw, h + 1);
+  }
+
+  void rows_where_one(unsigned h, std::vector<unsigned>& J) const {
+    J.clear();
+    for (unsigned j = 0; j < n; j++) {
+      if (data[j][h]) {
+        J.push_back(j);
+      }
     }
-    A_j[r] = 1;
-    r++;
   }
 
-  const std::set<unsigned> cols_where_one(unsigned j) const {
+  void cols_where_one(unsigned j, std::vector<unsigned>& H) const {
     const std::vector<int>& A_j = data[j];
-    std::set<unsigned> H;
-    for (unsigned h = 0; h < r; h++) {
+    H.clear();
+    for (unsigned h = 0; h < hw; h++) {
       if (A_j[h]) {
-        H.insert(h);
+        H.push_back(h);
       }
     }
-    return H;
   }
 
-  const std::set<unsigned> cols_where_one(unsigned j, unsigned k) const {
+  void cols_where_one(
+    unsigned j, unsigned k, std::vector<unsigned>& H) const
+  {
     const std::vector<int>& A_j = data[j];
     const std::vector<int>& A_k = data[k];
-    std::set<unsigned> H;
-    for (unsigned h = 0; h < r; h++) {
+    H.clear();
+    for (unsigned h = 0; h < hw; h++) {
       if (A_j[h] & A_k[h]) {
-        H.insert(h);
+        H.push_back(h);
       }
     }
-    return H;
   }
 
-  void drop_final_col() { r--; }
+  void drop_col(unsigned h) {
+    for (unsigned j = 0; j < n; j++) {
+      weight[j] -= data[j][h];
+      data[j][h] = 0;
+    }
+  }
+
+  void grow(unsigned n1) {
+    for (std::vector<int>& A_j : data) {
+      A_j.resize(n1 + 1, 0);
+    }
+    data.resize(n1, std::vector<int>(n1 + 1, 0));
+    weight.resize(n1, 0);
+    n = n1;
+  }
 };
 
-#else
+// Sparse storage in sets
+struct A_sparse {
+  using set = std::pmr::set<unsigned>;
 
-struct A_matrix::impl {
-  impl(unsigned n) : n(n), r(0), rows(n), cols(n+1) {}
+  A_sparse(unsigned n) : n(n), hw(0), rows(n), cols(n+1) {}
 
   /* Data */
 
   unsigned n;
-  unsigned r;
-  std::vector<std::set<unsigned>> rows;
-  std::vector<std::set<unsigned>> cols;
+  unsigned hw; // columns hw and above have never been used
+  // Nonzero entries in each row and column, shared with copies a block at a
+  // time; each block draws its nodes from its own pool
+  cow_vector<set, pooled_sets> rows;
+  cow_vector<set, pooled_sets> cols;
 
   /* Methods */
 
   int entry(unsigned j, unsigned h) const { return rows[j].contains(h); }
 
-  void add_col(unsigned h, unsigned k) {
-    std::set<unsigned> newcol;
-    for (unsigned j : cols[h]) {
-      if (!cols[k].contains(j)) {
-        newcol.insert(j);
-      }
+  // Insert x if absent, otherwise remove it
+  static void toggle(set& s, unsigned x) {
+    auto [it, inserted] = s.insert(x);
+    if (!inserted) {
+      s.erase(it);
     }
-    for (unsigned j : cols[k]) {
-      if (!cols[h].contains(j)) {
-        newcol.insert(j);
-      }
-    }
-    for (unsigned j : cols[h]) {
-      if (!newcol.contains(j)) {
-        rows[j].erase(h);
+  }
+
+  void add_col(std::span<const unsigned> H, unsigned c) {
+    for (unsigned j : cols[c]) {
+      for (unsigned h : H) {
+        toggle(rows[j], h);
+        toggle(cols[h], j);
       }
     }
-    for (unsigned j : newcol) {
-      rows[j].insert(h);
-    }
-    cols[h] = newcol;
   }
 
   void add_row(unsigned j, unsigned k) {
-    std::set<unsigned> newrow;
-    for (unsigned h : rows[j]) {
-      if (!rows[k].contains(h)) {
-        newrow.insert(h);
-      }
-    }
+    // In place, so that only entries that change touch the allocator:
     for (unsigned h : rows[k]) {
-      if (!rows[j].contains(h)) {
-        newrow.insert(h);
-      }
+      toggle(rows[j], h);
+      toggle(cols[h], j);
     }
+  }
+
+  void xor_row_into(unsigned j, uint64_t* v) const {
     for (unsigned h : rows[j]) {
-      if (!newrow.contains(h)) {
-        cols[h].erase(j);
-      }
+      flip_bit(v, h);
     }
-    for (unsigned h : newrow) {
-      cols[h].insert(j);
+  }
+
+  void xor_col_into(unsigned h, uint64_t* v) const {
+    for (unsigned j : cols[h]) {
+      flip_bit(v, j);
     }
-    rows[j] = newrow;
   }
 
   unsigned row_weight(unsigned j) const {
@@ -164,91 +546,119 @@ struct A_matrix::impl {
     return cols[h].size();
   }
 
-  void swap_col(unsigned h) {
-    for (unsigned j : cols[h]) {
-      if (!cols[r - 1].contains(j)) {
-        rows[j].erase(h);
-        rows[j].insert(r - 1);
-      }
+  void set_basis_col(unsigned j, unsigned h) {
+    for (unsigned k : rows[j]) {
+      cols[k].erase(j);
     }
-    for (unsigned j : cols[r - 1]) {
-      if (!cols[h].contains(j)) {
-        rows[j].erase(r - 1);
-        rows[j].insert(h);
-      }
-    }
-    std::iter_swap(cols.begin() + h, cols.begin() + (r - 1));
+    rows[j].clear();
+    rows[j].insert(h);
+    cols[h].insert(j);
+    hw = std::max(hw, h + 1);
   }
 
-  void zero_append_basis_col(unsigned j) {
-    for (unsigned h : rows[j]) {
-      cols[h].erase(j);
-    }
-    rows[j].clear();
-    rows[j].insert(r);
-    cols[r].insert(j);
-    r++;
+  void rows_where_one(unsigned h, std::vector<unsigned>& J) const {
+    J.assign(cols[h].begin(), cols[h].end());
   }
 
-  const std::set<unsigned> cols_where_one(unsigned j) const {
-    return rows[j];
+  void cols_where_one(unsigned j, std::vector<unsigned>& H) const {
+    H.assign(rows[j].begin(), rows[j].end());
   }
 
-  const std::set<unsigned> cols_where_one(unsigned j, unsigned k) const {
-    std::set<unsigned> l;
-    for (unsigned h : rows[j]) {
-      if (rows[k].contains(h)) {
-        l.insert(h);
-      }
-    }
-    return l;
+  void cols_where_one(
+    unsigned j, unsigned k, std::vector<unsigned>& H) const
+  {
+    H.clear();
+    std::set_intersection(
+      rows[j].begin(), rows[j].end(), rows[k].begin(), rows[k].end(),
+      std::back_inserter(H));
   }
 
-  void drop_final_col() {
-    for (unsigned j : cols[r - 1]) {
-      rows[j].erase(r - 1);
+  void drop_col(unsigned h) {
+    for (unsigned j : cols[h]) {
+      rows[j].erase(h);
     }
-    cols[r - 1].clear();
-    r--;
+    cols[h].clear();
+  }
+
+  void grow(unsigned n1) {
+    rows.resize(n1);
+    cols.resize(n1 + 1);
+    n = n1;
   }
 };
 
-#endif
 
-A_matrix::A_matrix(unsigned n) : pImpl(std::make_unique<impl>(n)) {}
+struct A_matrix::impl {
+  impl(unsigned n, storage s) : m(make(n, s)) {}
+
+  using variant = std::variant<A_sparse, A_flat, A_hybrid, A_dense, A_packed>;
+
+  static variant make(unsigned n, storage s) {
+    switch (s) {
+      case storage::flat: return A_flat(n);
+      case storage::hybrid: return A_hybrid(n);
+      case storage::dense: return A_dense(n);
+      case storage::packed: return A_packed(n);
+      default: return A_sparse(n);
+    }
+  }
+
+  template <typename F>
+  decltype(auto) visit(F f) { return std::visit(f, m); }
+
+  template <typename F>
+  decltype(auto) visit(F f) const { return std::visit(f, m); }
+
+  /* Data */
+
+  variant m;
+};
+
+A_matrix::A_matrix(unsigned n, storage s)
+  : pImpl(std::make_shared<impl>(n, s)) {}
 A_matrix::~A_matrix() = default;
-A_matrix::A_matrix(const A_matrix& other)
-  : pImpl(std::make_unique<impl>(*other.pImpl)) {}
+A_matrix::A_matrix(const A_matrix& other) = default;
 A_matrix::A_matrix(A_matrix&& other) = default;
-A_matrix& A_matrix::operator=(const A_matrix& other) {
-  return *this = A_matrix(other);
-}
+A_matrix& A_matrix::operator=(const A_matrix& other) = default;
 A_matrix& A_matrix::operator=(A_matrix&& other) = default;
 
-int A_matrix::entry(unsigned j, unsigned h) const { return pImpl->entry(j, h); }
-void A_matrix::add_col(unsigned h, unsigned k) { pImpl->add_col(h, k); }
-void A_matrix::add_row(unsigned j, unsigned k) { pImpl->add_row(j, k); }
-unsigned A_matrix::row_weight(unsigned j) const { return pImpl->row_weight(j); }
-unsigned A_matrix::col_weight(unsigned j) const { return pImpl->col_weight(j); }
-void A_matrix::swap_col(unsigned h) { pImpl->swap_col(h); }
-void A_matrix::zero_append_basis_col(unsigned j) {
-  pImpl->zero_append_basis_col(j);
+int A_matrix::entry(unsigned j, unsigned h) const {
+  return pImpl->visit([&](const auto& M) { return M.entry(j, h); });
 }
-const std::set<unsigned> A_matrix::cols_where_one(unsigned j) const {
-  return pImpl->cols_where_one(j);
+void A_matrix::add_col(std::span<const unsigned> H, unsigned c) {
+  unshare(pImpl).visit([&](auto& M) { M.add_col(H, c); });
 }
-const std::set<unsigned> A_matrix::cols_where_one(unsigned j, unsigned k) const {
-  return pImpl->cols_where_one(j, k);
+void A_matrix::add_row(unsigned j, unsigned k) {
+  unshare(pImpl).visit([&](auto& M) { M.add_row(j, k); });
 }
-void A_matrix::drop_final_col() { pImpl->drop_final_col(); }
-
-std::ostream& operator<<(std::ostream& os, const A_matrix& A) {
-  for (unsigned j = 0; j < A.pImpl->n; j++) {
-    os << "[ ";
-    for (unsigned h = 0; h < A.pImpl->r; h++) {
-      os << A.pImpl->entry(j, h) << " ";
-    }
-    os << "]" << std::endl;
-  }
-  return os;
+void A_matrix::xor_row_into(unsigned j, uint64_t* v) const {
+  pImpl->visit([&](const auto& M) { M.xor_row_into(j, v); });
+}
+void A_matrix::xor_col_into(unsigned h, uint64_t* v) const {
+  pImpl->visit([&](const auto& M) { M.xor_col_into(h, v); });
+}
+unsigned A_matrix::row_weight(unsigned j) const {
+  return pImpl->visit([&](const auto& M) { return M.row_weight(j); });
+}
+unsigned A_matrix::col_weight(unsigned h) const {
+  return pImpl->visit([&](const auto& M) { return M.col_weight(h); });
+}
+void A_matrix::set_basis_col(unsigned j, unsigned h) {
+  unshare(pImpl).visit([&](auto& M) { M.set_basis_col(j, h); });
+}
+void A_matrix::rows_where_one(unsigned h, std::vector<unsigned>& J) const {
+  pImpl->visit([&](const auto& M) { M.rows_where_one(h, J); });
+}
+void A_matrix::cols_where_one(unsigned j, std::vector<unsigned>& H) const {
+  pImpl->visit([&](const auto& M) { M.cols_where_one(j, H); });
+}
+void A_matrix::cols_where_one(
+  unsigned j, unsigned k, std::vector<unsigned>& H) const {
+  pImpl->visit([&](const auto& M) { M.cols_where_one(j, k, H); });
+}
+void A_matrix::drop_col(unsigned h) {
+  unshare(pImpl).visit([&](auto& M) { M.drop_col(h); });
+}
+void A_matrix::grow(unsigned n) {
+  unshare(pImpl).visit([&](auto& M) { M.grow(n); });
 }
@@ -1,14 +1,19 @@
 #pragma once
 
-#include <iostream>
+#include "storage.hpp"
+
+#include <cstdint>
 #include <memory>
-#include <set>
+#include <span>
+#include <vector>
 
 class A_matrix {
 public:
-  A_matrix(unsigned n);
+  A_matrix(unsigned n, storage s);
 
   ~A_matrix();
+  // Copies share storage until one of them is modified (and then, for the
+  // sparse backends, only the blocks of rows it modifies are copied).
   A_matrix(const A_matrix& other);
   A_matrix(A_matrix&& other);
   A_matrix& operator=(const A_matrix& other);
@@ -16,35 +21,45 @@ public:
 
   int entry(unsigned j, unsigned h) const;
 
-  // XOR column k into column h
-  void add_col(unsigned h, unsigned k);
+  // XOR column c into each column in H (in increasing order, without c)
+  void add_col(std::span<const unsigned> H, unsigned c);
 
   // XOR row k into row j
   void add_row(unsigned j, unsigned k);
 
+  // XOR row j into the bit vector v (indexed by column)
+  void xor_row_into(unsigned j, uint64_t* v) const;
+
+  // XOR column h into the bit vector v (indexed by row)
+  void xor_col_into(unsigned h, uint64_t* v) const;
+
   // Number of elements in row j containing 1
   unsigned row_weight(unsigned j) const;
 
   // Number of elements in column h containing 1
   unsigned col_weight(unsigned h) const;
 
-  // Swap column h with column r-1
-  void swap_col(unsigned h);
+  // Zero row j and set column h, which must be zero, to e_j
+  void set_basis_col(unsigned j, unsigned h);
 
-  // Zero row j and append new column e_j
-  void zero_append_basis_col(unsigned j);
+  // Write to J, in increasing order, the row indices j s.t. A[j,h] = 1
+  void rows_where_one(unsigned h, std::vector<unsigned>& J) const;
 
-  // Set of column indices h s.t. A[j,h] = 1
-  const std::set<unsigned> cols_where_one(unsigned j) const;
+  // Write to H, in increasing order, the column indices h s.t. A[j,h] = 1
+  void cols_where_one(unsigned j, std::vector<unsigned>& H) const;
 
-  // Set of column indices h s.t. A[j,h] = A[j,k] = 1
-  const std::set<unsigned> cols_where_one(unsigned j, unsigned k) const;
+  // Write to H, in increasing order, the column indices h s.t.
+  // A[j,h] = A[k,h] = 1
+  void cols_where_one(
+    unsigned j, unsigned k, std::vector<unsigned>& H) const;
 
-  void drop_final_col();
+  // Zero column h
+  void drop_col(unsigned h);
 
-  friend std::ostream& operator<<(std::ostream& os, const A_matrix& A);
+  // Add zero rows and columns to make n rows and n+1 columns
+  void grow(unsigned n);
 
 private:
   struct impl;
-  std::unique_ptr<impl> pImpl;
+  std::shared_ptr<impl> pImpl;
 };
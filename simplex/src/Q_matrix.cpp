@@ -1,58 +1,371 @@
 #include "Q_matrix.hpp"
+#include "bits.hpp"
+#include "cow.hpp"
+#include "hybrid_set.hpp"
+#include "node_pool.hpp"
+#include "sorted.hpp"
 #include <algorithm>
-#include <iostream>
+#include <cstdint>
 #include <memory>
+#include <memory_resource>
 #include <set>
+#include <span>
+#include <variant>
 #include <vector>
 
-#if defined (SIMPLEX_DENSE)
+// Bit-packed dense storage
+struct Q_packed {
+  // Each row is padded to a whole number of cache lines.
+  Q_packed(unsigned n)
+    : n(n), hw(0), stride((words_for(n + 1) + 7) & ~std::size_t(7)),
+    data((n + 1) * stride, 0), mask(stride, 0) {}
 
-struct Q_matrix::impl {
-  impl(unsigned n) : n(n), r(0), data(n+1, std::vector<int>(n+1, 0)) {}
+  /* Data */
+
+  unsigned n;
+  unsigned hw; // rows and columns hw and above have never been used
+  std::size_t stride; // words per row
+  // Row h occupies words [h * stride, (h + 1) * stride). Both halves of the
+  // symmetric matrix are stored so that rows can be combined a word at a time.
+  // Unused rows and columns are always zero.
+  std::vector<uint64_t, aligned_allocator<uint64_t>> data;
+  // Scratch space for add_rowcol and flip_submatrix; all zero between calls
+  std::vector<uint64_t, aligned_allocator<uint64_t>> mask;
+
+  /* Methods */
+
+  uint64_t* row(unsigned h) { return data.data() + h * stride; }
+  const uint64_t* row(unsigned h) const { return data.data() + h * stride; }
+
+  int entry(unsigned h1, unsigned h2) const { return get_bit(row(h1), h2); }
+
+  void add_rowcol(std::span<const unsigned> H, unsigned c) {
+    const uint64_t* Q_c = row(c);
+    const std::size_t nw = words_for(hw);
+    // 1. XOR row c into the rows in H:
+    for (unsigned h : H) {
+      uint64_t* Q_h = row(h);
+      for (std::size_t w = 0; w < nw; w++) {
+        Q_h[w] ^= Q_c[w];
+      }
+    }
+    // 2. XOR the mask of H into the rows where column c is 1 (this also
+    // clears the diagonal entries set in step 1):
+    uint64_t* m = mask.data();
+    for (unsigned h : H) {
+      set_bit(m, h);
+    }
+    for_each_set_bit(Q_c, nw, [&](unsigned j) {
+      uint64_t* Q_j = row(j);
+      for (std::size_t w = 0; w < nw; w++) {
+        Q_j[w] ^= m[w];
+      }
+    });
+    for (unsigned h : H) {
+      clear_bit(m, h);
+    }
+  }
+
+  void rowcol_support(unsigned h, std::vector<unsigned>& H) const {
+    H.clear();
+    for_each_set_bit(row(h), words_for(hw), [&](unsigned k) {
+      H.push_back(k);
+    });
+  }
+
+  // XOR the mask of H into row h, for each h in H1
+  void xor_mask(std::span<const unsigned> H1, std::span<const unsigned> H) {
+    uint64_t* m = mask.data();
+    for (unsigned h : H) {
+      set_bit(m, h);
+    }
+    const std::size_t nw = words_for(hw);
+    for (unsigned h : H1) {
+      uint64_t* Q_h = row(h);
+      for (std::size_t w = 0; w < nw; w++) {
+        Q_h[w] ^= m[w];
+      }
+    }
+    for (unsigned h : H) {
+      clear_bit(m, h);
+    }
+  }
+
+  void flip_submatrix(std::span<const unsigned> H) {
+    xor_mask(H, H);
+    // Restore the zero diagonal:
+    for (unsigned h : H) {
+      flip_bit(row(h), h);
+    }
+  }
+
+  void flip_submatrix(
+    std::span<const unsigned> H1, std::span<const unsigned> H2)
+  {
+    // Entries (h, h) for h in both H1 and H2 are flipped twice.
+    xor_mask(H1, H2);
+    xor_mask(H2, H1);
+  }
+
+  void set_rowcol(unsigned h, std::span<const unsigned> H) {
+    uint64_t* Q_h = row(h);
+    for (unsigned k : H) {
+      set_bit(Q_h, k);
+      set_bit(row(k), h);
+    }
+    hw = std::max(hw, h + 1);
+  }
+
+  void xor_col_into(unsigned h, uint64_t* v) const {
+    const uint64_t* Q_h = row(h);
+    const std::size_t nw = words_for(hw);
+    for (std::size_t w = 0; w < nw; w++) {
+      v[w] ^= Q_h[w];
+    }
+  }
+
+  bool rowcol_is_zero(unsigned h) const {
+    const uint64_t* Q_h = row(h);
+    return std::all_of(
+      Q_h, Q_h + words_for(hw), [](uint64_t x) { return x == 0; });
+  }
+
+  void drop_rowcol(unsigned h) {
+    uint64_t* Q_h = row(h);
+    for_each_set_bit(Q_h, words_for(hw), [&](unsigned k) {
+      clear_bit(row(k), h);
+    });
+    std::fill(Q_h, Q_h + words_for(hw), 0);
+  }
+
+  void grow(unsigned n1) {
+    const std::size_t stride1 = (words_for(n1 + 1) + 7) & ~std::size_t(7);
+    if (stride1 != stride) {
+      std::vector<uint64_t, aligned_allocator<uint64_t>> data1(
+        (n1 + 1) * stride1, 0);
+      for (unsigned h = 0; h <= n; h++) {
+        std::copy(row(h), row(h) + stride, data1.data() + h * stride1);
+      }
+      data.swap(data1);
+      stride = stride1;
+      mask.assign(stride, 0);
+    } else {
+      data.resize((n1 + 1) * stride, 0);
+    }
+    n = n1;
+  }
+};
+
+// Sparse storage in sorted vectors
+struct Q_flat {
+  Q_flat(unsigned n) : n(n), hw(0), rows(n+1) {}
 
   /* Data */
 
   unsigned n;
-  unsigned r;
-  std::vector<std::vector<int>> data;
+  unsigned hw; // rows and columns hw and above have never been used
+  // Sorted indices of the nonzero entries in each row (never the diagonal),
+  // shared with copies a block at a time
+  cow_vector<std::vector<uint32_t>> rows;
+  // Scratch space for merges
+  std::vector<uint32_t> tmp;
 
   /* Methods */
 
-  int entry(unsigned h1, unsigned h2) const { return data[h1][h2]; }
+  int entry(unsigned h1, unsigned h2) const {
+    return sorted_contains(rows[h1], uint32_t(h2));
+  }
+
+  void add_rowcol(std::span<const unsigned> H, unsigned c) {
+    // The diagonal entries flipped in the first loop are flipped back in the
+    // second.
+    for (uint32_t h : H) {
+      sorted_xor(rows[h], rows[c], tmp);
+    }
+    for (uint32_t j : rows[c]) {
+      sorted_xor(rows[j], H, tmp);
+    }
+  }
+
+  void rowcol_support(unsigned h, std::vector<unsigned>& H) const {
+    H.assign(rows[h].begin(), rows[h].end());
+  }
+
+  void flip_submatrix(std::span<const unsigned> H) {
+    for (uint32_t h : H) {
+      sorted_xor(rows[h], H, tmp);
+      sorted_erase(rows[h], h);
+    }
+  }
+
+  void flip_submatrix(
+    std::span<const unsigned> H1, std::span<const unsigned> H2)
+  {
+    // Rows in both H1 and H2 have their diagonal flipped twice.
+    for (uint32_t h : H1) {
+      sorted_xor(rows[h], H2, tmp);
+    }
+    for (uint32_t h : H2) {
+      sorted_xor(rows[h], H1, tmp);
+    }
+  }
+
+  void set_rowcol(unsigned h, std::span<const unsigned> H) {
+    rows[h].assign(H.begin(), H.end());
+    for (uint32_t k : H) {
+      sorted_insert(rows[k], uint32_t(h));
+    }
+    hw = std::max(hw, h + 1);
+  }
+
+  void xor_col_into(unsigned h, uint64_t* v) const {
+    for (uint32_t k : rows[h]) {
+      flip_bit(v, k);
+    }
+  }
+
+  bool rowcol_is_zero(unsigned h) const {
+    return rows[h].empty();
+  }
+
+  void drop_rowcol(unsigned h) {
+    for (uint32_t k : rows[h]) {
+      sorted_erase(rows[k], uint32_t(h));
+    }
+    rows[h].clear();
+  }
+
+  void grow(unsigned n1) {
+    rows.resize(n1 + 1);
+    n = n1;
+  }
+};
+
+// Per-row choice of sorted array or bitmap
+struct Q_hybrid {
+  Q_hybrid(unsigned n) : n(n), hw(0), rows(n+1, hybrid_set(n+1)) {}
+
+  /* Data */
+
+  unsigned n;
+  unsigned hw; // rows and columns hw and above have never been used
+  // Nonzero entries in each row (never the diagonal), shared with copies a
+  // block at a time
+  cow_vector<hybrid_set> rows;
+  // Scratch space for merges
+  std::vector<unsigned> tmp;
+
+  /* Methods */
+
+  int entry(unsigned h1, unsigned h2) const {
+    return rows[h1].contains(h2);
+  }
+
+  void add_rowcol(std::span<const unsigned> H, unsigned c) {
+    // The diagonal entries flipped in the first loop are flipped back in the
+    // second.
+    for (unsigned h : H) {
+      rows[h].xor_with(rows[c], tmp);
+    }
+    rows[c].for_each([&](unsigned j) { rows[j].xor_with(H, tmp); });
+  }
 
-  void add_rowcol(unsigned h, unsigned k) {
-    for (unsigned j = 0; j < r; j++) {
-      data[j][h] ^= data[j][k];
+  void rowcol_support(unsigned h, std::vector<unsigned>& H) const {
+    H.clear();
+    rows[h].append_to(H);
+  }
+
+  void flip_submatrix(std::span<const unsigned> H) {
+    for (unsigned h : H) {
+      rows[h].xor_with(H, tmp);
+      rows[h].erase(h);
     }
-    for (unsigned j = 0; j < r; j++) {
-      data[h][j] ^= data[k][j];
+  }
+
+  void flip_submatrix(
+    std::span<const unsigned> H1, std::span<const unsigned> H2)
+  {
+    // Rows in both H1 and H2 have their diagonal flipped twice.
+    for (unsigned h : H1) {
+      rows[h].xor_with(H2, tmp);
+    }
+    for (unsigned h : H2) {
+      rows[h].xor_with(H1, tmp);
+    }
+  }
+
+  void set_rowcol(unsigned h, std::span<const unsigned> H) {
+    for (unsigned k : H) {
+      rows[h].insert(k);
+      rows[k].insert(h);
+    }
+    hw = std::max(hw, h + 1);
+  }
+
+  void xor_col_into(unsigned h, uint64_t* v) const {
+    rows[h].for_each([&](unsigned k) { flip_bit(v, k); });
+  }
+
+  bool rowcol_is_zero(unsigned h) const {
+    return rows[h].empty();
+  }
+
+  void drop_rowcol(unsigned h) {
+    rows[h].for_each([&](unsigned k) { rows[k].erase(h); });
+    rows[h].clear();
+  }
+
+  void grow(unsigned n1) {
+    for (unsigned h = 0; h <= n; h++) {
+      rows[h].grow(n1 + 1);
     }
+    rows.resize(n1 + 1, hybrid_set(n1 + 1));
+    n = n1;
   }
+};
+
+// Dense storage
+struct Q_dense {
+  Q_dense(unsigned n) : n(n), hw(0), data(n+1, std::vector<int>(n+1, 0)) {}
 
-  void swap_rowcol(unsigned h) {
-    const unsigned r1 = r - 1;
-    for (unsigned j = 0; j < r; j++) {
-      int t = data[j][h];
-      data[j][h] = data[j][r1];
-      data[j][r1] = t;
+  /* Data */
+
+  unsigned n;
+  unsigned hw; // rows and columns hw and above have never been used
+  // Unused rows and columns are always zero.
+  std::vector<std::vector<int>> data;
+
+  /* Methods */
+
+  int entry(unsigned h1, unsigned h2) const { return data[h1][h2]; }
+
+  void add_rowcol(std::span<const unsigned> H, unsigned c) {
+    const std::vector<int>& Q_c = data[c];
+    for (unsigned h : H) {
+      for (unsigned j = 0; j < hw; j++) {
+        data[h][j] ^= Q_c[j];
+      }
     }
-    for (unsigned j = 0; j < r; j++) {
-      int t = data[h][j];
-      data[h][j] = data[r1][j];
-      data[r1][j] = t;
+    for (unsigned j = 0; j < hw; j++) {
+      if (Q_c[j]) {
+        for (unsigned h : H) {
+          data[j][h] ^= 1;
+        }
+      }
     }
   }
 
-  const std::set<unsigned> rows_with_terminal_1() const {
-    std::set<unsigned> H;
-    unsigned r1 = r - 1;
-    for (unsigned h = 0; h < r1; h++) {
-      if (data[h][r1]) H.insert(h);
+  void rowcol_support(unsigned h, std::vector<unsigned>& H) const {
+    H.clear();
+    for (unsigned k = 0; k < hw; k++) {
+      if (k != h && data[h][k]) H.push_back(k);
     }
-    return H;
   }
 
-  void flip_submatrix(const std::set<unsigned>& H) {
+  // With an int per entry, XOR-ing a mask of H into each row would touch
+  // |H| * hw entries rather than |H|^2, so the entries are flipped one by one.
+  // Q_packed is the backend with the word-at-a-time mask kernel.
+  void flip_submatrix(std::span<const unsigned> H) {
     for (unsigned h1 : H) {
       for (unsigned h2 : H) {
         if (h1 != h2) {
@@ -63,7 +376,7 @@ struct Q_matrix::impl {
   }
 
   void flip_submatrix(
-    const std::set<unsigned>& H1, const std::set<unsigned>& H2)
+    std::span<const unsigned> H1, std::span<const unsigned> H2)
   {
     for (unsigned h1 : H1) {
       for (unsigned h2 : H2) {
@@ -73,18 +386,21 @@ struct Q_matrix::impl {
     }
   }
 
-  void append_rowcol(const std::set<unsigned>& H) {
-    for (unsigned h = 0; h < r; h++) {
-      data[h][r] = data[r][h] = 0;
+  void set_rowcol(unsigned h, std::span<const unsigned> H) {
+    for (unsigned k : H) {
+      data[k][h] = data[h][k] = 1;
     }
-    for (unsigned h : H) {
-      data[h][r] = data[r][h] = 1;
+    hw = std::max(hw, h + 1);
+  }
+
+  void xor_col_into(unsigned h, uint64_t* v) const {
+    for (unsigned k = 0; k < hw; k++) {
+      if (k != h && data[k][h]) flip_bit(v, k);
     }
-    r++;
   }
 
   bool rowcol_is_zero(unsigned h) const {
-    for (unsigned j = 0; j < r; j++) {
+    for (unsigned j = 0; j < hw; j++) {
       if (j != h && data[h][j]) {
         return false;
       }
@@ -92,116 +408,103 @@ struct Q_matrix::impl {
     return true;
   }
 
-  void drop_final_rowcol() { r--; }
-};
+  void drop_rowcol(unsigned h) {
+    for (unsigned k = 0; k < hw; k++) {
+      data[k][h] = data[h][k] = 0;
+    }
+  }
 
-#else
+  void grow(unsigned n1) {
+    for (std::vector<int>& Q_h : data) {
+      Q_h.resize(n1 + 1, 0);
+    }
+    data.resize(n1 + 1, std::vector<int>(n1 + 1, 0));
+    n = n1;
+  }
+};
 
-struct Q_matrix::impl {
-  impl(unsigned n) : n(n), r(0), rows(n+1) {}
+// Sparse storage in sets
+struct Q_sparse {
+  Q_sparse(unsigned n) : n(n), hw(0), rows(n+1) {}
 
   /* Data */
 
   unsigned n;
-  unsigned r;
-  std::vector<std::set<unsigned>> rows;
-  std::vector<std::set<unsigned>> cols;
+  unsigned hw; // rows and columns hw and above have never been used
+  // As for A_sparse, rows are shared a block at a time and each block has
+  // its own pool.
+  cow_vector<std::pmr::set<unsigned>, pooled_sets> rows;
 
   /* Methods */
 
   int entry(unsigned h1, unsigned h2) const { return rows[h1].contains(h2); }
 
-  void add_rowcol(unsigned h, unsigned k) {
-    // 1. Compute what the new row will be:
-    std::set<unsigned> newrow;
-    for (unsigned j : rows[h]) {
-      if (!rows[k].contains(j)) {
-        newrow.insert(j);
-      }
-    }
-    for (unsigned j : rows[k]) {
-      if (j != h && !rows[h].contains(j)) {
-        newrow.insert(j);
+  void add_rowcol(std::span<const unsigned> H, unsigned c) {
+    // The diagonal entries flipped in the first loop are flipped back in the
+    // second.
+    for (unsigned h : H) {
+      for (unsigned j : rows[c]) {
+        toggle(h, j);
       }
     }
-    // 2. Fix up the other rows for symmetry:
-    for (unsigned j : rows[h]) {
-      if (!newrow.contains(j)) {
-        rows[j].erase(h);
+    for (unsigned j : rows[c]) {
+      for (unsigned h : H) {
+        toggle(j, h);
       }
     }
-    for (unsigned j : newrow) {
-      rows[j].insert(h);
-    }
-    // 3. Replace the row:
-    rows[h] = newrow;
   }
 
-  void swap_rowcol(unsigned h) {
-    std::set<unsigned> D1(rows[h]);
-    for (unsigned k : rows[r - 1]) {
-      D1.erase(k);
-    }
-    D1.erase(h); D1.erase(r - 1);
-    std::set<unsigned> D2(rows[r - 1]);
+  void rowcol_support(unsigned h, std::vector<unsigned>& H) const {
+    H.clear();
     for (unsigned k : rows[h]) {
-      D2.erase(k);
-    }
-    D2.erase(h); D2.erase(r - 1);
-    for (unsigned k : D1) {
-      rows[h].erase(k); rows[k].erase(h);
-      rows[r - 1].insert(k); rows[k].insert(r - 1);
-    }
-    for (unsigned k : D2) {
-      rows[r - 1].erase(k); rows[k].erase(r - 1);
-      rows[h].insert(k); rows[k].insert(h);
+      if (k != h) H.push_back(k);
     }
   }
 
-  const std::set<unsigned> rows_with_terminal_1() const {
-    return rows[r - 1];
+  // Flip the (h1, h2) entry in one tree operation (no symmetry fix-up)
+  void toggle(unsigned h1, unsigned h2) {
+    auto [it, inserted] = rows[h1].insert(h2);
+    if (!inserted) {
+      rows[h1].erase(it);
+    }
   }
 
-  void flip_submatrix(const std::set<unsigned>& H) {
+  void flip_submatrix(std::span<const unsigned> H) {
+    // Row by row, so that each ordered pair costs a single tree operation:
     for (unsigned h1 : H) {
       for (unsigned h2 : H) {
-        if (h1 < h2) {
-          if (rows[h1].contains(h2)) {
-            rows[h1].erase(h2);
-            rows[h2].erase(h1);
-          } else {
-            rows[h1].insert(h2);
-            rows[h2].insert(h1);
-          }
+        if (h1 != h2) {
+          toggle(h1, h2);
         }
       }
     }
   }
 
   void flip_submatrix(
-    const std::set<unsigned>& H1, const std::set<unsigned>& H2)
+    std::span<const unsigned> H1, std::span<const unsigned> H2)
   {
     for (unsigned h1 : H1) {
       for (unsigned h2 : H2) {
         if (h1 != h2) {
-          if (rows[h1].contains(h2)) {
-            rows[h1].erase(h2);
-            rows[h2].erase(h1);
-          } else {
-            rows[h1].insert(h2);
-            rows[h2].insert(h1);
-          }
+          toggle(h1, h2);
+          toggle(h2, h1);
         }
       }
     }
   }
 
-  void append_rowcol(const std::set<unsigned>& H) {
-    for (unsigned h : H) {
-      rows[r].insert(h);
-      rows[h].insert(r);
+  void set_rowcol(unsigned h, std::span<const unsigned> H) {
+    for (unsigned k : H) {
+      rows[h].insert(k);
+      rows[k].insert(h);
+    }
+    hw = std::max(hw, h + 1);
+  }
+
+  void xor_col_into(unsigned h, uint64_t* v) const {
+    for (unsigned k : rows[h]) {
+      if (k != h) flip_bit(v, k);
     }
-    r++;
   }
 
   bool rowcol_is_zero(unsigned h) const {
@@ -215,60 +518,84 @@ struct Q_matrix::impl {
     }
   }
 
-  void drop_final_rowcol() {
-    for (unsigned h : rows[r - 1]) {
-      if (h != r - 1) {
-        rows[h].erase(r - 1);
+  void drop_rowcol(unsigned h) {
+    for (unsigned k : rows[h]) {
+      if (k != h) {
+        rows[k].erase(h);
       }
     }
-    rows[r - 1].clear();
-    r--;
+    rows[h].clear();
+  }
+
+  void grow(unsigned n1) {
+    rows.resize(n1 + 1);
+    n = n1;
   }
 };
 
-#endif
 
-Q_matrix::Q_matrix(unsigned n) : pImpl(std::make_unique<impl>(n)) {}
+struct Q_matrix::impl {
+  impl(unsigned n, storage s) : m(make(n, s)) {}
+
+  using variant = std::variant<Q_sparse, Q_flat, Q_hybrid, Q_dense, Q_packed>;
+
+  static variant make(unsigned n, storage s) {
+    switch (s) {
+      case storage::flat: return Q_flat(n);
+      case storage::hybrid: return Q_hybrid(n);
+      case storage::dense: return Q_dense(n);
+      case storage::packed: return Q_packed(n);
+      default: return Q_sparse(n);
+    }
+  }
+
+  template <typename F>
+  decltype(auto) visit(F f) { return std::visit(f, m); }
+
+  template <typename F>
+  decltype(auto) visit(F f) const { return std::visit(f, m); }
+
+  /* Data */
+
+  variant m;
+};
+
+Q_matrix::Q_matrix(unsigned n, storage s)
+  : pImpl(std::make_shared<impl>(n, s)) {}
 Q_matrix::~Q_matrix() = default;
-Q_matrix::Q_matrix(const Q_matrix& other)
-  : pImpl(std::make_unique<impl>(*other.pImpl)) {}
+Q_matrix::Q_matrix(const Q_matrix& other) = default;
 Q_matrix::Q_matrix(Q_matrix&& other) = default;
-Q_matrix& Q_matrix::operator=(const Q_matrix& other) {
-  return *this = Q_matrix(other);
-}
+Q_matrix& Q_matrix::operator=(const Q_matrix& other) = default;
 Q_matrix& Q_matrix::operator=(Q_matrix&& other) = default;
 
 int Q_matrix::entry(unsigned h1, unsigned h2) const {
-  return pImpl->entry(h1, h2);
+  return pImpl->visit([&](const auto& M) { return M.entry(h1, h2); });
+}
+void Q_matrix::add_rowcol(std::span<const unsigned> H, unsigned c) {
+  unshare(pImpl).visit([&](auto& M) { M.add_rowcol(H, c); });
 }
-void Q_matrix::add_rowcol(unsigned h, unsigned k) { pImpl->add_rowcol(h, k); }
-void Q_matrix::swap_rowcol(unsigned h) { pImpl->swap_rowcol(h); }
-const std::set<unsigned> Q_matrix::rows_with_terminal_1() const {
-  return pImpl->rows_with_terminal_1();
+void Q_matrix::rowcol_support(unsigned h, std::vector<unsigned>& H) const {
+  pImpl->visit([&](const auto& M) { M.rowcol_support(h, H); });
 }
-void Q_matrix::flip_submatrix(const std::set<unsigned>& H) {
-  pImpl->flip_submatrix(H);
+void Q_matrix::flip_submatrix(std::span<const unsigned> H) {
+  unshare(pImpl).visit([&](auto& M) { M.flip_submatrix(H); });
 }
 void Q_matrix::flip_submatrix(
-  const std::set<unsigned>& H1, const std::set<unsigned>& H2) {
-  pImpl->flip_submatrix(H1, H2);
+  std::span<const unsigned> H1, std::span<const unsigned> H2) {
+  unshare(pImpl).visit([&](auto& M) { M.flip_submatrix(H1, H2); });
 }
-void Q_matrix::append_rowcol(const std::set<unsigned>& H) {
-  pImpl->append_rowcol(H);
+void Q_matrix::set_rowcol(unsigned h, std::span<const unsigned> H) {
+  unshare(pImpl).visit([&](auto& M) { M.set_rowcol(h, H); });
+}
+void Q_matrix::xor_col_into(unsigned h, uint64_t* v) const {
+  pImpl->visit([&](const auto& M) { M.xor_col_into(h, v); });
 }
 bool Q_matrix::rowcol_is_zero(unsigned h) const {
-  return pImpl->rowcol_is_zero(h);
+  return pImpl->visit([&](const auto& M) { return M.rowcol_is_zero(h); });
 }
-void Q_matrix::drop_final_rowcol() {pImpl->drop_final_rowcol(); }
-unsigned Q_matrix::r() const { return pImpl->r; }
-
-std::ostream& operator<<(std::ostream& os, const Q_matrix& Q) {
-  for (unsigned j = 0; j < Q.pImpl->r; j++) {
-    os << "[ ";
-    for (unsigned h = 0; h < Q.pImpl->r; h++) {
-      os << Q.pImpl->entry(j, h) << " ";
-    }
-    os << "]" << std::endl;
-  }
-  return os;
+void Q_matrix::drop_rowcol(unsigned h) {
+  unshare(pImpl).visit([&](auto& M) { M.drop_rowcol(h); });
+}
+void Q_matrix::grow(unsigned n) {
+  unshare(pImpl).visit([&](auto& M) { M.grow(n); });
 }
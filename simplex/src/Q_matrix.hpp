@@ -1,15 +1,20 @@
 #pragma once
 
-#include <iostream>
+#include "storage.hpp"
+
+#include <cstdint>
 #include <memory>
-#include <set>
+#include <span>
+#include <vector>
 
 // A symmetric 0,1 off-diagonal matrix
 class Q_matrix {
 public:
-  Q_matrix(unsigned n);
+  Q_matrix(unsigned n, storage s);
 
   ~Q_matrix();
+  // Copies share storage until one of them is modified (and then, for the
+  // sparse backends, only the blocks of rows it modifies are copied).
   Q_matrix(const Q_matrix& other);
   Q_matrix(Q_matrix&& other);
   Q_matrix& operator=(const Q_matrix& other);
@@ -17,35 +22,37 @@ public:
 
   int entry(unsigned h1, unsigned h2) const;
 
-  // XOR row/column k into row/column h
-  void add_rowcol(unsigned h, unsigned k);
+  // Write to H, in increasing order, the k s.t. Q[h][k] = 1
+  void rowcol_support(unsigned h, std::vector<unsigned>& H) const;
 
-  // Swap row/column with row/column r-1
-  void swap_rowcol(unsigned h);
+  // Index sets passed to the following methods must be in increasing order.
 
-  // Set of h s.t. Q[h][r-1] = 1
-  const std::set<unsigned> rows_with_terminal_1() const;
+  // XOR row/column c into each row/column in H (which must not contain c)
+  void add_rowcol(std::span<const unsigned> H, unsigned c);
 
   // Flip the (h1, h2) entry for all h1, h2 in H
-  void flip_submatrix(const std::set<unsigned>& H);
+  void flip_submatrix(std::span<const unsigned> H);
 
   // Flip the (h1, h2) entry for all h1 in H1, h2 in H2 (preserving symmetry)
   void flip_submatrix(
-    const std::set<unsigned>& H1, const std::set<unsigned>& H2);
+    std::span<const unsigned> H1, std::span<const unsigned> H2);
+
+  // Set row/column h, which must be zero, to 1 at the indices in H
+  void set_rowcol(unsigned h, std::span<const unsigned> H);
 
-  // Append new row/column (given as set of indices where 1)
-  void append_rowcol(const std::set<unsigned>& H);
+  // XOR column h into the bit vector v
+  void xor_col_into(unsigned h, uint64_t* v) const;
 
   // Whether a given row/column is all-zero
   bool rowcol_is_zero(unsigned h) const;
 
-  void drop_final_rowcol();
-
-  unsigned r() const;
+  // Zero row/column h
+  void drop_rowcol(unsigned h);
 
-  friend std::ostream& operator<<(std::ostream& os, const Q_matrix& Q);
+  // Add zero rows and columns to make n+1 of each
+  void grow(unsigned n);
 
 private:
   struct impl;
-  std::unique_ptr<impl> pImpl;
+  std::shared_ptr<impl> pImpl;
 };
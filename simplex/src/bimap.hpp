@@ -1,87 +1,62 @@
 #pragma once
 
-#include <iostream>
-#include <map>
+#include <cstdint>
 #include <optional>
+#include <vector>
 
 /**
- * A bijection between two sets of unsigned integers.
+ * A bijection between subsets of {0, ..., m-1} and {0, ..., n-1}.
+ *
+ * Both directions are stored as arrays, with a sentinel for unmatched
+ * elements, so that every operation is O(1).
  */
 class Bimap {
 public:
-  Bimap() : fwd(), inv() {}
+  Bimap(unsigned m, unsigned n) : fwd(m, none), inv(n, none) {}
 
   std::optional<unsigned> fwd_at(unsigned i) const {
-    auto j = fwd.find(i);
-    if (j != fwd.end()) {
-      return j->second;
+    int32_t j = fwd[i];
+    if (j != none) {
+      return j;
     }
     return std::nullopt;
   }
 
   std::optional<unsigned> inv_at(unsigned j) const {
-    auto i = inv.find(j);
-    if (i != inv.end()) {
-      return i->second;
+    int32_t i = inv[j];
+    if (i != none) {
+      return i;
     }
     return std::nullopt;
   }
 
   void fwd_erase(unsigned i) {
-    auto j = fwd.find(i);
-    if (j != fwd.end()) {
-      unsigned j1 = j->second;
-      fwd.erase(i);
-      inv.erase(j1);
+    int32_t j = fwd[i];
+    if (j != none) {
+      inv[j] = none;
+      fwd[i] = none;
     }
   }
 
   void make_match(unsigned i, unsigned j) {
-    std::optional<unsigned> j1 = fwd_at(i);
-    std::optional<unsigned> i1 = inv_at(j);
-    if (j1 && (*j1 == j)) return;
-    insert_pair(i, j);
-    if (i1) fwd.erase(*i1);
-    if (j1) inv.erase(*j1);
+    int32_t j1 = fwd[i];
+    int32_t i1 = inv[j];
+    if (j1 == int32_t(j)) return;
+    if (i1 != none) fwd[i1] = none;
+    if (j1 != none) inv[j1] = none;
+    fwd[i] = j;
+    inv[j] = i;
   }
 
-  // Swap fwd[i1] and fwd[i2]
-  void swap_fwd(unsigned i1, unsigned i2) {
-    std::optional<unsigned> j1 = fwd_at(i1);
-    std::optional<unsigned> j2 = fwd_at(i2);
-    if (j1) {
-      fwd.erase(i1);
-      inv.erase(*j1);
-    }
-    if (j2) {
-      fwd.erase(i2);
-      inv.erase(*j2);
-    }
-    if (j1) {
-      insert_pair(i2, *j1);
-    }
-    if (j2) {
-      insert_pair(i1, *j2);
-    }
+  // Enlarge the sets to {0, ..., m1-1} and {0, ..., n1-1}
+  void grow(unsigned m1, unsigned n1) {
+    fwd.resize(m1, none);
+    inv.resize(n1, none);
   }
 
-  friend std::ostream& operator<<(std::ostream& os, const Bimap& p);
-
 private:
-  void insert_pair(unsigned i, unsigned j) {
-    fwd[i] = j;
-    inv[j] = i;
-  }
+  static constexpr int32_t none = -1;
 
-  std::map<unsigned, unsigned> fwd;
-  std::map<unsigned, unsigned> inv;
+  std::vector<int32_t> fwd;
+  std::vector<int32_t> inv;
 };
-
-inline std::ostream& operator<<(std::ostream& os, const Bimap& p) {
-  for (auto ij : p.fwd) {
-    unsigned i = ij.first;
-    unsigned j = ij.second;
-    os << i << ":" << j << " ";
-  }
-  return os;
-}
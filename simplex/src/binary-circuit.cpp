@@ -0,0 +1,126 @@
+#include "binary-circuit.hpp"
+#include "mapped_file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr char magic[8] = {'S', 'I', 'M', 'P', 'L', 'E', 'X', 'C'};
+constexpr uint32_t version = 1;
+
+struct header {
+  char magic[8];
+  uint32_t version;
+  uint32_t n;
+  uint64_t n_ops;
+};
+
+// Operations are read in place, so their layout is part of the format:
+static_assert(sizeof(header) == 24);
+static_assert(sizeof(struct op) == 12);
+static_assert(offsetof(struct op, qubits) == 4);
+
+} // namespace
+
+void write_binary_circuit(const struct instrs& is, const char *p) {
+  std::ofstream out(p, std::ios::binary);
+  header h;
+  std::memcpy(h.magic, magic, sizeof(magic));
+  h.version = version;
+  h.n = is.n;
+  h.n_ops = is.ops.size();
+  out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  for (const auto& op : is.ops) {
+    // Copy field by field, so that the padding is zero:
+    char rec[sizeof(struct op)] = {};
+    rec[0] = char(op.type);
+    std::memcpy(rec + offsetof(struct op, qubits), op.qubits.data(),
+      sizeof(op.qubits));
+    out.write(rec, sizeof(rec));
+  }
+  if (!out.flush()) {
+    throw std::runtime_error("Cannot write " + std::string(p));
+  }
+}
+
+bool is_binary_circuit(const char *p) {
+  // Reading the magic from a pipe would consume it:
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(p, ec)) return false;
+  std::ifstream in(p, std::ios::binary);
+  char buf[sizeof(magic)];
+  return in.read(buf, sizeof(buf)) &&
+    std::memcmp(buf, magic, sizeof(magic)) == 0;
+}
+
+struct binary_circuit::impl {
+  impl(const char *p) : file(p) {
+    const std::string_view text = file.contents();
+    header h;
+    if (text.size() < sizeof(h)) {
+      throw std::runtime_error("Not a binary circuit: " + std::string(p));
+    }
+    std::memcpy(&h, text.data(), sizeof(h));
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0) {
+      throw std::runtime_error("Not a binary circuit: " + std::string(p));
+    }
+    if (h.version != version) {
+      throw std::runtime_error(
+        "Unsupported binary circuit version: " + std::string(p));
+    }
+    if ((text.size() - sizeof(h)) / sizeof(struct op) != h.n_ops ||
+        (text.size() - sizeof(h)) % sizeof(struct op) != 0) {
+      throw std::runtime_error("Truncated binary circuit: " + std::string(p));
+    }
+    n = h.n;
+    ops = {
+      reinterpret_cast<const struct op *>(text.data() + sizeof(h)),
+      std::size_t(h.n_ops)};
+    // The simulator does not check its arguments, so check them here:
+    std::vector<std::size_t> ends; // ends of the enclosing loop bodies
+    for (std::size_t i = 0; i < ops.size(); i++) {
+      while (!ends.empty() && ends.back() == i) {
+        ends.pop_back();
+      }
+      const struct op &op = ops[i];
+      const bool two = (op.type == optype::CX || op.type == optype::CZ);
+      bool ok;
+      if (op.type == optype::Repeat) {
+        const std::size_t end = i + 1 + std::size_t(op.qubits[1]);
+        ok = end <= (ends.empty() ? ops.size() : ends.back());
+        ends.push_back(end);
+      } else {
+        ok = op.type < optype::Repeat && op.qubits[0] < n &&
+          (two ? op.qubits[1] < n : op.qubits[1] == 0);
+      }
+      if (!ok) {
+        throw std::runtime_error(
+          "Invalid operation in binary circuit: " + std::string(p));
+      }
+    }
+  }
+
+  /* Data */
+
+  mapped_file file;
+  unsigned n;
+  std::span<const struct op> ops;
+};
+
+binary_circuit::binary_circuit(const char *p)
+  : pImpl(std::make_unique<impl>(p)) {}
+
+binary_circuit::~binary_circuit() = default;
+
+unsigned binary_circuit::n() const { return pImpl->n; }
+
+std::span<const struct op> binary_circuit::ops() const { return pImpl->ops; }
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+/* Helpers for GF(2) vectors packed into 64-bit words */
+
+constexpr unsigned word_bits = 64;
+
+// Number of words needed to hold nbits bits
+inline std::size_t words_for(std::size_t nbits) {
+  return (nbits + word_bits - 1) / word_bits;
+}
+
+inline int get_bit(const uint64_t* w, unsigned i) {
+  return (w[i / word_bits] >> (i % word_bits)) & 1;
+}
+
+inline void set_bit(uint64_t* w, unsigned i) {
+  w[i / word_bits] |= uint64_t(1) << (i % word_bits);
+}
+
+inline void clear_bit(uint64_t* w, unsigned i) {
+  w[i / word_bits] &= ~(uint64_t(1) << (i % word_bits));
+}
+
+inline void flip_bit(uint64_t* w, unsigned i) {
+  w[i / word_bits] ^= uint64_t(1) << (i % word_bits);
+}
+
+// Call f(i) for each i such that bit i is set, in increasing order
+template <typename F>
+void for_each_set_bit(const uint64_t* w, std::size_t nw, F f) {
+  for (std::size_t k = 0; k < nw; k++) {
+    uint64_t x = w[k];
+    while (x) {
+      f(unsigned(k * word_bits + std::countr_zero(x)));
+      x &= x - 1;
+    }
+  }
+}
+
+// Call f(k, m) for each word k containing an index in the increasing sequence
+// H, where m has a bit set for each such index
+template <typename R, typename F>
+void for_each_word_mask(const R& H, F f) {
+  auto it = H.begin();
+  const auto end = H.end();
+  while (it != end) {
+    const std::size_t k = *it / word_bits;
+    uint64_t m = 0;
+    do {
+      m |= uint64_t(1) << (*it % word_bits);
+      ++it;
+    } while (it != end && *it / word_bits == k);
+    f(k, m);
+  }
+}
+
+// A vector of bits packed into 64-bit words
+class bitvec {
+public:
+  bitvec(std::size_t nbits) : w(words_for(nbits), 0) {}
+
+  int operator[](unsigned i) const { return get_bit(w.data(), i); }
+
+  void set(unsigned i, int x) {
+    if (x) {
+      set_bit(w.data(), i);
+    } else {
+      clear_bit(w.data(), i);
+    }
+  }
+
+  void flip(unsigned i) { flip_bit(w.data(), i); }
+
+  // Enlarge to hold nbits bits, the new ones zero
+  void resize(std::size_t nbits) { w.resize(words_for(nbits), 0); }
+
+  // Flip the bits at the increasing sequence of indices H
+  template <typename R>
+  void flip(const R& H) {
+    for_each_word_mask(H, [&](std::size_t k, uint64_t m) { w[k] ^= m; });
+  }
+
+  uint64_t* data() { return w.data(); }
+  const uint64_t* data() const { return w.data(); }
+
+  uint64_t& word(std::size_t k) { return w[k]; }
+
+private:
+  std::vector<uint64_t> w;
+};
+
+/**
+ * Allocator returning storage aligned to Align bytes (a cache line by
+ * default).
+ */
+template <typename T, std::size_t Align = 64>
+struct aligned_allocator {
+  using value_type = T;
+
+  template <typename U>
+  struct rebind { using other = aligned_allocator<U, Align>; };
+
+  aligned_allocator() = default;
+  template <typename U>
+  aligned_allocator(const aligned_allocator<U, Align>&) {}
+
+  T* allocate(std::size_t k) {
+    return static_cast<T*>(
+      ::operator new(k * sizeof(T), std::align_val_t(Align)));
+  }
+
+  void deallocate(T* p, std::size_t) {
+    ::operator delete(p, std::align_val_t(Align));
+  }
+
+  template <typename U>
+  bool operator==(const aligned_allocator<U, Align>&) const { return true; }
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/* Copy-on-write support for objects held by shared_ptr */
+
+// Make p the only owner of its object, by copying the object if it is shared,
+// and return the object for modification
+template <typename T>
+T& unshare(std::shared_ptr<T>& p) {
+  if (p.use_count() > 1) {
+    p = std::make_shared<T>(*p);
+  } else {
+    // Order our writes after any reads made through copies released by other
+    // threads:
+    std::atomic_thread_fence(std::memory_order_acquire);
+  }
+  return *p;
+}
+
+/**
+ * A vector whose elements are kept in blocks of B, each shared between copies
+ * of the vector until one of them writes to it. Copying the vector copies one
+ * pointer per block, and the first write to a block after that copies just
+ * that block.
+ *
+ * Access through a non-const vector makes the element's block private first,
+ * so that it can be modified, and so that references into it stay valid
+ * while other blocks are made private. Access through a const vector only
+ * reads.
+ *
+ * Block is the container for one block: std::vector<T> by default, or a type
+ * with the same size(), resize() and operator[] whose copies need more care
+ * (such as pooled_sets).
+ */
+template <typename T, typename Block = std::vector<T>, std::size_t B = 64>
+class cow_vector {
+public:
+  cow_vector() = default;
+  explicit cow_vector(std::size_t n) { resize(n); }
+  cow_vector(std::size_t n, const T& x) { resize(n, x); }
+
+  std::size_t size() const { return count; }
+
+  const T& operator[](std::size_t i) const { return (*blocks[i / B])[i % B]; }
+  T& operator[](std::size_t i) { return unshare(blocks[i / B])[i % B]; }
+
+  void resize(std::size_t n) {
+    resize_with(n, [](Block& b, std::size_t k) { b.resize(k); });
+  }
+
+  void resize(std::size_t n, const T& x) {
+    resize_with(n, [&](Block& b, std::size_t k) { b.resize(k, x); });
+  }
+
+private:
+  // Resize to n elements, calling f(b, k) to resize a block b to k elements
+  template <typename F>
+  void resize_with(std::size_t n, F f) {
+    const std::size_t n_blocks = (n + B - 1) / B;
+    if (blocks.size() > n_blocks) {
+      blocks.resize(n_blocks);
+    }
+    for (std::size_t i = 0; i < n_blocks; i++) {
+      const std::size_t k = std::min(B, n - i * B);
+      if (i == blocks.size()) {
+        blocks.push_back(std::make_shared<Block>());
+      } else if (blocks[i]->size() == k) {
+        continue;
+      }
+      f(unshare(blocks[i]), k);
+    }
+    count = n;
+  }
+
+  std::vector<std::shared_ptr<Block>> blocks;
+  std::size_t count = 0;
+};
@@ -0,0 +1,486 @@
+#pragma once
+
+#include "A_matrix.hpp"
+#include "Q_matrix.hpp"
+#include "bimap.hpp"
+#include "bits.hpp"
+#include "parse-stim.hpp"
+#include "values.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+/**
+ * The simulation algorithm of [BH21], with the coin-dependent part of the
+ * state (b, R1 and g) held as values of the policy Vals (see values.hpp).
+ */
+template <typename Vals>
+struct engine {
+  using value = typename Vals::value;
+
+  engine(unsigned n, int seed, storage s)
+    : n(n), r(0), perm(n+1), pos(n+1), A(n, s),
+    b(Vals::make_vector(n)), Q(n, s), R0(n+1), R1(Vals::make_vector(n+1)),
+    p(n+1, n), g{}, deterministic(true), vals(seed), Q_c(n+1)
+  {
+    std::iota(perm.begin(), perm.end(), 0);
+    std::iota(pos.begin(), pos.end(), 0);
+    // Reserve the index buffers at their largest possible size, so that
+    // applying gates never reallocates them:
+    for (auto* v : {&H, &H_k, &H_jk, &J, &H_p, &H_z, &H_c, &H_v}) {
+      v->reserve(n + 1);
+    }
+  }
+
+  /* Data */
+
+  unsigned n;
+  unsigned r;
+  // Columns of A (and rows/columns of Q, and entries of R0, R1 and the domain
+  // of p) are stored in fixed physical slots. Logical column l of the
+  // algorithm is physical column perm[l], and pos is the inverse of perm, so
+  // that reordering columns only touches these two arrays. Logical columns r
+  // and above map to unused (zero) physical columns.
+  std::vector<unsigned> perm;
+  std::vector<unsigned> pos;
+  A_matrix A;
+  typename Vals::vector b;
+  Q_matrix Q;
+  bitvec R0;
+  typename Vals::vector R1;
+  Bimap p;
+  typename Vals::phase g;
+  bool deterministic;
+  Vals vals;
+  // Buffers for index sets, reused from gate to gate:
+  std::vector<unsigned> H;    // columns where a row is 1
+  std::vector<unsigned> H_k;  // ... for a second row
+  std::vector<unsigned> H_jk; // ... for both rows
+  std::vector<unsigned> J;    // rows where a column is 1
+  std::vector<unsigned> H_p;  // for MakePrincipal
+  std::vector<unsigned> H_z;  // for ZeroColumnElim
+  std::vector<unsigned> H_c;  // for ReindexSubtColumns
+  std::vector<unsigned> H_v;  // for xor_A_row, xor_A_col, xor_Q_col
+  bitvec Q_c;                 // for ReindexSubtColumns; all zero between uses
+
+  /* Methods */
+
+  // Vectors of bits are updated a word at a time
+  static constexpr bool packed = std::is_same_v<typename Vals::vector, bitvec>;
+
+  // XOR x into v[h] for each h where row j of A is 1
+  void xor_A_row(unsigned j, typename Vals::vector& v, const value& x) {
+    if constexpr (packed) {
+      if (x) A.xor_row_into(j, v.data());
+    } else {
+      A.cols_where_one(j, H_v);
+      Vals::xor_over(v, H_v, x);
+    }
+  }
+
+  // XOR x into v[i] for each i where column h of A is 1
+  void xor_A_col(unsigned h, typename Vals::vector& v, const value& x) {
+    if constexpr (packed) {
+      if (x) A.xor_col_into(h, v.data());
+    } else {
+      A.rows_where_one(h, H_v);
+      Vals::xor_over(v, H_v, x);
+    }
+  }
+
+  // XOR x into v[k] for each k where column h of Q is 1
+  void xor_Q_col(unsigned h, typename Vals::vector& v, const value& x) {
+    if constexpr (packed) {
+      if (x) Q.xor_col_into(h, v.data());
+    } else {
+      Q.rowcol_support(h, H_v);
+      Vals::xor_over(v, H_v, x);
+    }
+  }
+
+  // Subtract column c from each column in H (in increasing order, without c)
+  void ReindexSubtColumns(std::span<const unsigned> H, unsigned c) {
+    if (H.empty()) return;
+    const int R0c = R0[c];
+    // R[k] += R[c] + 2 Q[k][c] (mod 4) for k in H:
+    Q.xor_col_into(c, Q_c.data());
+    Vals::subtract(R0, R1, Q_c, H, R0c, Vals::get(R1, c));
+    Q.xor_col_into(c, Q_c.data());
+    A.add_col(H, c);
+    Q.add_rowcol(H, c);
+    if (R0c) {
+      H_c.assign(H.begin(), H.end());
+      H_c.insert(std::lower_bound(H_c.begin(), H_c.end(), c), c);
+      Q.flip_submatrix(H_c);
+    }
+  }
+
+  void MakePrincipal(unsigned c, unsigned j) {
+    if (A.entry(j, c)) {
+      A.cols_where_one(j, H_p);
+      H_p.erase(std::lower_bound(H_p.begin(), H_p.end(), c));
+      // This zeroes A[j][k] for k != c but changes no other entries in A_j:
+      ReindexSubtColumns(H_p, c);
+      p.make_match(c, j);
+    }
+  }
+
+  void ReselectPrincipalRow(
+    unsigned c, std::optional<unsigned> j = std::nullopt)
+  {
+    // The row of least weight (other than j), and its weight:
+    std::optional<unsigned> j0;
+    unsigned n0 = 0;
+    A.rows_where_one(c, J);
+    for (unsigned j1 : J) {
+      if (!j || j1 != *j) {
+        unsigned n1 = A.row_weight(j1);
+        if (!j0 || n1 < n0) {
+          j0 = j1;
+          n0 = n1;
+        }
+      }
+    }
+    if (j0) {
+      MakePrincipal(c, *j0);
+    }
+  }
+
+  std::optional<unsigned> principate(unsigned j) {
+    std::optional<unsigned> c = p.inv_at(j);
+    if (c) {
+      ReselectPrincipalRow(*c, j);
+      if (j != *p.fwd_at(*c)) {
+        c = std::nullopt;
+      }
+    }
+    return c;
+  }
+
+  // Physical index of the final column
+  unsigned final_col() const { return perm[r - 1]; }
+
+  // Swap column k with the final column
+  void ReindexSwapColumn(unsigned k) {
+    const unsigned l = pos[k];
+    const unsigned k1 = perm[r - 1];
+    perm[l] = k1;
+    pos[k1] = l;
+    perm[r - 1] = k;
+    pos[k] = r - 1;
+  }
+
+  void expand(unsigned j, std::span<const unsigned> H) {
+    const unsigned c = perm[r];
+    A.set_basis_col(j, c);
+    Q.set_rowcol(c, H);
+    r++;
+  }
+
+  void contract() {
+    const unsigned c = final_col();
+    A.drop_col(c);
+    Q.drop_rowcol(c);
+    p.fwd_erase(c);
+    r--;
+  }
+
+  void FixFinalBit(const value& z) {
+    const unsigned c = final_col();
+    xor_A_col(c, b, z);
+    xor_Q_col(c, R1, z);
+    if (R0[c]) Vals::add_phase(g, 2, z);
+    Vals::add_phase(g, 4, z, Vals::get(R1, c));
+    contract();
+  }
+
+  void ZeroColumnElim(unsigned c) {
+    ReindexSwapColumn(c);
+    Q.rowcol_support(c, H_z);
+    const int u0 = R0[c];
+    const value u1 = Vals::get(R1, c);
+    contract();
+    if (u0) {
+      Q.flip_submatrix(H_z);
+      Vals::twist(R0, R1, H_z, u1 ^ Vals::one());
+      Vals::add_phase(g, 2);
+      Vals::add_phase(g, 7);
+      Vals::add_phase(g, 6, u1);
+    } else if (!H_z.empty()) {
+      // The first of these columns in logical order:
+      unsigned l = *std::min_element(
+        H_z.begin(), H_z.end(),
+        [&](unsigned h1, unsigned h2) { return pos[h1] < pos[h2]; });
+      H_z.erase(std::lower_bound(H_z.begin(), H_z.end(), l));
+      ReindexSubtColumns(H_z, l);
+      ReindexSwapColumn(l);
+      FixFinalBit(u1);
+    }
+  }
+
+  void new_principal_column(
+    unsigned j,
+    int r0, value r1,
+    std::optional<unsigned> c = std::nullopt,
+    std::span<const unsigned> H = {})
+  {
+    expand(j, H);
+    const unsigned h = final_col();
+    Vals::set(b, j, value{});
+    R0.set(h, r0);
+    Vals::set(R1, h, std::move(r1));
+    p.make_match(h, j);
+    if (c) {
+      ZeroColumnElim(*c);
+    }
+  }
+
+  // The gates X and Z take a value m, and act as the identity where it is 0
+  // (to apply corrections after resets).
+
+  void SimulateX(unsigned j, const value& m = Vals::one()) {
+    Vals::xor_at(b, j, m);
+  }
+
+  void SimulateY(unsigned j) {
+    Vals::add_phase(g, 2);
+    SimulateZ(j); SimulateX(j);
+  }
+
+  void SimulateZ(unsigned j, const value& m = Vals::one()) {
+    Vals::add_phase(g, 4, Vals::get(b, j), m);
+    xor_A_row(j, R1, m);
+  }
+
+  void SimulateH(unsigned j) {
+    std::optional<unsigned> c = principate(j);
+    A.cols_where_one(j, H);
+    new_principal_column(j, 0, Vals::get(b, j), c, H);
+  }
+
+  void SimulateS(unsigned j) {
+    A.cols_where_one(j, H);
+    Q.flip_submatrix(H);
+    const value z = Vals::get(b, j);
+    Vals::twist(R0, R1, H, z);
+    Vals::add_phase(g, 2, z);
+  }
+
+  void SimulateSdg(unsigned j) {
+    A.cols_where_one(j, H);
+    Q.flip_submatrix(H);
+    const value z = Vals::get(b, j);
+    Vals::twist(R0, R1, H, z ^ Vals::one());
+    Vals::add_phase(g, 6, z);
+  }
+
+  void SimulateCX(unsigned j, unsigned k) {
+    A.add_row(k, j);
+    Vals::xor_at(b, k, Vals::get(b, j));
+    std::optional<unsigned> c = p.inv_at(k);
+    if (c) {
+      ReselectPrincipalRow(*c);
+    }
+  }
+
+  void SimulateCZ(unsigned j, unsigned k) {
+    std::vector<unsigned>& H_j = H;
+    A.cols_where_one(j, H_j);
+    A.cols_where_one(k, H_k);
+    Q.flip_submatrix(H_j, H_k);
+    A.cols_where_one(j, k, H_jk);
+    Vals::xor_over(R1, H_jk, Vals::one());
+    const value z_j = Vals::get(b, j);
+    const value z_k = Vals::get(b, k);
+    Vals::xor_over(R1, H_j, z_k);
+    Vals::xor_over(R1, H_k, z_j);
+    Vals::add_phase(g, 4, z_j, z_k);
+  }
+
+  value toss_coin(std::optional<int> coin) {
+    deterministic = false;
+    if (coin) {
+      return Vals::constant(*coin);
+    } else {
+      return vals.coin();
+    }
+  }
+
+  value SimulateMeasX(unsigned j, std::optional<int> coin = std::nullopt) {
+    value beta;
+    std::optional<unsigned> c = principate(j);
+    if (c && Q.rowcol_is_zero(*c)) {
+      if (R0[*c] == 0) {
+        return Vals::get(R1, *c);
+      } else {
+        beta = toss_coin(coin);
+        R0.set(*c, 0);
+        Vals::set(R1, *c, beta);
+        return beta;
+      }
+    } else {
+      beta = toss_coin(coin);
+    }
+    xor_A_row(j, R1, beta);
+    new_principal_column(j, 0, beta, c);
+    return beta;
+  }
+
+  value SimulateMeasY(unsigned j, std::optional<int> coin = std::nullopt) {
+    value beta;
+    std::optional<unsigned> c = principate(j);
+    if (c && Q.rowcol_is_zero(*c)) {
+      if (R0[*c] == 1) {
+        return Vals::get(R1, *c) ^ Vals::get(b, j);
+      } else {
+        beta = toss_coin(coin);
+        R0.set(*c, 1);
+        Vals::set(R1, *c, beta);
+        return beta;
+      }
+    } else {
+      beta = toss_coin(coin);
+    }
+    A.cols_where_one(j, H);
+    Q.flip_submatrix(H);
+    const value z = Vals::get(b, j) ^ beta;
+    Vals::twist(R0, R1, H, z ^ Vals::one());
+    new_principal_column(j, 1, beta, c);
+    return beta;
+  }
+
+  value SimulateMeasZ(unsigned j, std::optional<int> coin = std::nullopt) {
+    if (A.row_weight(j) == 0) {
+      return Vals::get(b, j);
+    } else {
+      value beta = toss_coin(coin);
+      A.cols_where_one(j, H);
+      // The first column of least weight, in logical order:
+      unsigned k = H.front();
+      unsigned m = A.col_weight(k);
+      for (auto it = H.begin() + 1; it != H.end(); ++it) {
+        const unsigned h = *it;
+        unsigned c = A.col_weight(h);
+        if (c < m || (c == m && pos[h] < pos[k])) {
+          k = h;
+          m = c;
+        }
+      }
+      ReindexSwapColumn(k);
+      MakePrincipal(k, j);
+      FixFinalBit(beta ^ Vals::get(b, j));
+      return beta;
+    }
+  }
+
+  void SimulateResetX(unsigned j) {
+    SimulateZ(j, SimulateMeasX(j, 0));
+  }
+
+  void SimulateResetY(unsigned j) {
+    SimulateX(j, SimulateMeasY(j, 0));
+  }
+
+  void SimulateResetZ(unsigned j) {
+    SimulateX(j, SimulateMeasZ(j, 0));
+  }
+
+  // Apply an operation, passing the outcome of a measurement to f
+  template <typename F>
+  void apply(const struct op& op, F& f) {
+    switch (op.type) {
+      case optype::X: SimulateX(op.qubits[0]); break;
+      case optype::Y: SimulateY(op.qubits[0]); break;
+      case optype::Z: SimulateZ(op.qubits[0]); break;
+      case optype::H: SimulateH(op.qubits[0]); break;
+      case optype::S: SimulateS(op.qubits[0]); break;
+      case optype::Sdg: SimulateSdg(op.qubits[0]); break;
+      case optype::CX: SimulateCX(op.qubits[0], op.qubits[1]); break;
+      case optype::CZ: SimulateCZ(op.qubits[0], op.qubits[1]); break;
+      case optype::MeasX: f(SimulateMeasX(op.qubits[0])); break;
+      case optype::MeasY: f(SimulateMeasY(op.qubits[0])); break;
+      case optype::MeasZ: f(SimulateMeasZ(op.qubits[0])); break;
+      case optype::ResetX: SimulateResetX(op.qubits[0]); break;
+      case optype::ResetY: SimulateResetY(op.qubits[0]); break;
+      case optype::ResetZ: SimulateResetZ(op.qubits[0]); break;
+      default:
+        std::cerr << "Unrecognized operation" << std::endl;
+        throw;
+    }
+  }
+
+  // Apply a list of instructions (which may contain loops), passing the
+  // outcome of each measurement to f in turn
+  template <typename F>
+  void run_ops(std::span<const struct op> ops, F& f) {
+    for (std::size_t i = 0; i < ops.size(); i++) {
+      const struct op& op = ops[i];
+      if (op.type == optype::Repeat) {
+        const auto body = ops.subspan(i + 1, op.qubits[1]);
+        for (unsigned k = 0; k < op.qubits[0]; k++) {
+          run_ops(body, f);
+        }
+        i += op.qubits[1];
+      } else {
+        apply(op, f);
+      }
+    }
+  }
+
+  template <typename F>
+  void run(std::span<const struct op> ops, F f) {
+    run_ops(ops, f);
+  }
+
+  template <typename F>
+  void run(const struct instrs& is, F f) {
+    run_ops(is.ops, f);
+  }
+
+  // Apply the instructions from a reader as they are parsed, adding qubits
+  // when they are first used
+  template <typename F>
+  void run(stim_reader& in, F f) {
+    struct op op;
+    std::vector<struct op> body;
+    while (in.next(op)) {
+      if (in.n() > n) grow(in.n());
+      if (op.type == optype::Repeat) {
+        in.read_body(op, body);
+        for (unsigned k = 0; k < op.qubits[0]; k++) {
+          run_ops(body, f);
+        }
+      } else {
+        apply(op, f);
+      }
+    }
+  }
+
+  // Add qubits in the zero state, so that there are n1 in all
+  void grow(unsigned n1) {
+    for (unsigned h = n + 1; h <= n1; h++) {
+      perm.push_back(h);
+      pos.push_back(h);
+    }
+    A.grow(n1);
+    Vals::resize(b, n1);
+    Q.grow(n1);
+    R0.resize(n1 + 1);
+    Vals::resize(R1, n1 + 1);
+    p.grow(n1 + 1, n1);
+    Q_c.resize(n1 + 1);
+    for (auto* v : {&H, &H_k, &H_jk, &J, &H_p, &H_z, &H_c, &H_v}) {
+      if (v->capacity() < n1 + 1) {
+        v->reserve(std::max<std::size_t>(n1 + 1, 2 * v->capacity()));
+      }
+    }
+    n = n1;
+  }
+
+  bool is_deterministic() const { return deterministic; }
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include "bits.hpp"
+#include "sorted.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * A subset of {0, ..., U-1} that is stored as a sorted array while it is
+ * small and as a bitmap once it is large, converting between the two as its
+ * size crosses a threshold.
+ *
+ * An array of k indices takes 32k bits and a bitmap takes U bits, so the set
+ * switches to a bitmap when k > U/32, and back to an array (with some
+ * hysteresis) when k < U/64.
+ */
+class hybrid_set {
+public:
+  hybrid_set(unsigned U) : U(U), count(0), is_bitmap(false) {}
+
+  unsigned size() const { return count; }
+
+  bool empty() const { return count == 0; }
+
+  bool contains(unsigned x) const {
+    return is_bitmap ? get_bit(bits.data(), x) : sorted_contains(arr, x);
+  }
+
+  void insert(unsigned x) {
+    if (!contains(x)) toggle(x);
+  }
+
+  void erase(unsigned x) {
+    if (contains(x)) toggle(x);
+  }
+
+  void toggle(unsigned x) {
+    if (is_bitmap) {
+      count += get_bit(bits.data(), x) ? -1 : 1;
+      flip_bit(bits.data(), x);
+    } else {
+      sorted_toggle(arr, x);
+      count = arr.size();
+    }
+    rebalance();
+  }
+
+  void clear() {
+    arr.clear();
+    bits.clear();
+    bits.shrink_to_fit();
+    is_bitmap = false;
+    count = 0;
+  }
+
+  // Enlarge the universe to {0, ..., U1-1}
+  void grow(unsigned U1) {
+    U = U1;
+    if (is_bitmap) {
+      bits.resize(words_for(U), 0);
+    }
+    rebalance();
+  }
+
+  // Replace with the symmetric difference with another set
+  void xor_with(const hybrid_set& other, std::vector<unsigned>& tmp) {
+    if (other.is_bitmap && !is_bitmap) {
+      to_bitmap();
+    }
+    if (is_bitmap) {
+      if (other.is_bitmap) {
+        count = 0;
+        for (std::size_t w = 0; w < bits.size(); w++) {
+          bits[w] ^= other.bits[w];
+          count += std::popcount(bits[w]);
+        }
+        rebalance();
+      } else {
+        xor_with(std::span<const unsigned>(other.arr), tmp);
+      }
+    } else {
+      sorted_xor(arr, other.arr, tmp);
+      count = arr.size();
+      rebalance();
+    }
+  }
+
+  // Replace with the symmetric difference with a sorted list of indices
+  void xor_with(std::span<const unsigned> H, std::vector<unsigned>& tmp) {
+    if (is_bitmap) {
+      for (unsigned x : H) {
+        count += get_bit(bits.data(), x) ? -1 : 1;
+        flip_bit(bits.data(), x);
+      }
+    } else {
+      sorted_xor(arr, H, tmp);
+      count = arr.size();
+    }
+    rebalance();
+  }
+
+  // Call f(x) for each x in the set, in increasing order
+  template <typename F>
+  void for_each(F f) const {
+    if (is_bitmap) {
+      for_each_set_bit(bits.data(), bits.size(), f);
+    } else {
+      for (unsigned x : arr) {
+        f(x);
+      }
+    }
+  }
+
+  // Append the elements to out, in increasing order
+  void append_to(std::vector<unsigned>& out) const {
+    if (is_bitmap) {
+      for_each([&](unsigned x) { out.push_back(x); });
+    } else {
+      out.insert(out.end(), arr.begin(), arr.end());
+    }
+  }
+
+  // Write the intersection of a and b to out, in increasing order
+  friend void intersect(
+    const hybrid_set& a, const hybrid_set& b, std::vector<unsigned>& out)
+  {
+    if (a.is_bitmap && b.is_bitmap) {
+      out.clear();
+      for (std::size_t w = 0; w < a.bits.size(); w++) {
+        const uint64_t x = a.bits[w] & b.bits[w];
+        for_each_set_bit(&x, 1, [&](unsigned h) {
+          out.push_back(w * word_bits + h);
+        });
+      }
+    } else if (a.is_bitmap || b.is_bitmap) {
+      const hybrid_set& s = a.is_bitmap ? b : a;
+      const hybrid_set& l = a.is_bitmap ? a : b;
+      out.clear();
+      for (unsigned x : s.arr) {
+        if (get_bit(l.bits.data(), x)) {
+          out.push_back(x);
+        }
+      }
+    } else {
+      sorted_intersect(a.arr, b.arr, out);
+    }
+  }
+
+private:
+  void to_bitmap() {
+    bits.assign(words_for(U), 0);
+    for (unsigned x : arr) {
+      set_bit(bits.data(), x);
+    }
+    arr.clear();
+    arr.shrink_to_fit();
+    is_bitmap = true;
+  }
+
+  void to_array() {
+    arr.clear();
+    arr.reserve(count);
+    for_each_set_bit(bits.data(), bits.size(), [&](unsigned x) {
+      arr.push_back(x);
+    });
+    bits.clear();
+    bits.shrink_to_fit();
+    is_bitmap = false;
+  }
+
+  void rebalance() {
+    if (is_bitmap) {
+      if (64 * count < U) to_array();
+    } else {
+      if (32 * count > U) to_bitmap();
+    }
+  }
+
+  unsigned U;
+  unsigned count;
+  bool is_bitmap;
+  std::vector<unsigned> arr;
+  std::vector<uint64_t> bits;
+};
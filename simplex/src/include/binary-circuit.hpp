@@ -0,0 +1,83 @@
+#pragma once
+
+#include "parse-stim.hpp"
+
+#include <memory>
+#include <span>
+
+/*
+ * Binary circuit format
+ *
+ * A precompiled list of instructions that can be loaded without parsing. A
+ * file consists of a 24-byte header:
+ *
+ * - bytes 0-7: the characters "SIMPLEXC";
+ * - bytes 8-11: the format version (currently 1);
+ * - bytes 12-15: the number of qubits;
+ * - bytes 16-23: the number of operations;
+ *
+ * followed by the operations, 12 bytes each: the optype in byte 0, zero in
+ * bytes 1-3 and the two qubits (zero if unused) in bytes 4-11. Loops are
+ * stored as in struct op, as a Repeat header followed by the body. Integers are
+ * stored in the byte order of the machine that wrote the file, so a file
+ * written with the other byte order is rejected as being of an unsupported
+ * version.
+ */
+
+/**
+ * Write instructions to a file in the binary circuit format.
+ *
+ * @param is instructions
+ * @param p path to output file
+ *
+ * @throws std::runtime_error if the file cannot be written
+ */
+void write_binary_circuit(const struct instrs& is, const char *p);
+
+/**
+ * Whether a file is in the binary circuit format (of any version).
+ *
+ * @param p path to file
+ *
+ * @return whether the file is a regular one starting with the magic
+ *         characters (pipes, which can only be read once, are taken to be
+ *         Stim)
+ */
+bool is_binary_circuit(const char *p);
+
+/**
+ * A circuit file in the binary format, mapped into memory so that the
+ * operations are read in place.
+ */
+class binary_circuit {
+public:
+  /**
+   * Map and check a file.
+   *
+   * @param p path to file
+   *
+   * @throws std::runtime_error if the file is not a valid circuit in a
+   *         supported version of the format
+   */
+  explicit binary_circuit(const char *p);
+
+  ~binary_circuit();
+
+  /**
+   * Get the number of qubits
+   *
+   * @return number of qubits
+   */
+  unsigned n() const;
+
+  /**
+   * Get the operations, valid while this object exists
+   *
+   * @return operations
+   */
+  std::span<const struct op> ops() const;
+
+private:
+  struct impl;
+  std::unique_ptr<impl> pImpl;
+};
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <span>
 #include <vector>
 
-enum optype {
+enum optype : uint8_t {
   X,
   Y,
   Z,
@@ -16,12 +22,18 @@ enum optype {
   MeasZ,
   ResetX,
   ResetY,
-  ResetZ
+  ResetZ,
+  Repeat
 };
 
+// An operation on qubits[0] or, for CX and CZ, on qubits[0] and qubits[1].
+// Unused entries are zero.
+//
+// A Repeat operation is the header of a loop: the next qubits[1] operations
+// (the body, which may contain further loops) are executed qubits[0] times.
 struct op {
   optype type;
-  std::vector<unsigned> qubits;
+  std::array<unsigned, 2> qubits;
 };
 
 struct instrs {
@@ -29,13 +41,96 @@ struct instrs {
   std::vector<struct op> ops;
 };
 
+/**
+ * Call f(o, times) for each operation o in a list, other than the headers of
+ * loops, where times is the number of times that o is executed (or
+ * UINT64_MAX if that does not fit in 64 bits).
+ */
+template <typename F>
+void for_each_op(std::span<const struct op> ops, F f, uint64_t times = 1) {
+  constexpr uint64_t max_times = std::numeric_limits<uint64_t>::max();
+  for (std::size_t i = 0; i < ops.size(); i++) {
+    const struct op &o = ops[i];
+    if (o.type == optype::Repeat) {
+      const uint64_t reps = o.qubits[0];
+      for_each_op(
+        ops.subspan(i + 1, o.qubits[1]), f,
+        (reps != 0 && times > max_times / reps) ? max_times : times * reps);
+      i += o.qubits[1];
+    } else {
+      f(o, times);
+    }
+  }
+}
+
 /**
  * Parse a Stim file.
  *
- * Only a subset of Stim syntax is supported.
+ * Only a subset of Stim syntax is supported. REPEAT blocks are kept as loops
+ * (see struct op) rather than unrolled. A file in the binary circuit
+ * format (see binary-circuit.hpp) is loaded instead of parsed.
  *
  * @param p path to file
  *
  * @return parsed list of instructions
+ *
+ * @throws std::runtime_error if the file cannot be opened
  */
 struct instrs parse_file(const char *p);
+
+/**
+ * Reader of Stim instructions, returning one operation at a time.
+ *
+ * The input is parsed a line at a time, so that memory use does not grow with
+ * the length of the circuit. A REPEAT block is parsed whole, and returned as
+ * a Repeat operation followed by its body.
+ */
+class stim_reader {
+public:
+  /**
+   * Read from a stream (such as std::cin).
+   *
+   * @param in input stream
+   */
+  stim_reader(std::istream &in);
+
+  /**
+   * Read from a file (which may be a pipe).
+   *
+   * @param p path to file
+   *
+   * @throws std::runtime_error if the file cannot be opened
+   */
+  stim_reader(const char *p);
+
+  ~stim_reader();
+
+  /**
+   * Read the next operation.
+   *
+   * @param o output: the operation
+   *
+   * @retval true an operation was read
+   * @retval false the end of the input was reached
+   */
+  bool next(struct op &o);
+
+  /**
+   * Read the body of a loop, after its header has been read.
+   *
+   * @param o the Repeat operation just read
+   * @param body output: the operations of the body
+   */
+  void read_body(const struct op &o, std::vector<struct op> &body);
+
+  /**
+   * Get the number of qubits in the circuit so far
+   *
+   * @return one more than the largest qubit index read so far
+   */
+  unsigned n() const;
+
+private:
+  struct impl;
+  std::unique_ptr<impl> pImpl;
+};
@@ -1,8 +1,42 @@
 #pragma once
 
+#include "storage.hpp"
+
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <optional>
+#include <string_view>
+#include <vector>
+
+struct instrs;
+
+/**
+ * Measurement results from many shots of a circuit
+ *
+ * Row i holds the results of shot i, one bit per measurement instruction in
+ * circuit order, packed into 64-bit words: the result of measurement k is bit
+ * k % 64 of word k / 64 of the row.
+ */
+struct shot_results {
+  unsigned n_shots;
+  unsigned n_meas;
+  std::size_t stride; // words per row
+  std::vector<uint64_t> data;
+
+  /**
+   * Get a measurement result
+   *
+   * @param i shot index
+   * @param k measurement index
+   *
+   * @return result of measurement k in shot i
+   */
+  int get(unsigned i, unsigned k) const {
+    return (data[i * stride + k / 64] >> (k % 64)) & 1;
+  }
+};
 
 /**
  * Clifford circuit simulator
@@ -14,8 +48,9 @@ public:
    *
    * @param n number of qubits
    * @param seed seed for PRNG
+   * @param s storage scheme for the internal matrices
    */
-  Simplex(unsigned n, int seed = 0);
+  Simplex(unsigned n, int seed = 0, storage s = storage::automatic);
 
   /**
    * Construct a simulator initialized in the all-zero state and apply the
@@ -25,12 +60,77 @@ public:
    *
    * Not all Stim instruction types are supported.
    *
-   * @param p path to Stim file
+   * The instructions are applied as they are parsed, so memory use does not
+   * grow with the length of the circuit. A file in the binary circuit format
+   * (see binary-circuit.hpp) is run in place without parsing.
+   *
+   * A path that is not a regular file (such as a pipe) is read once, as a
+   * stream of Stim, like standard input.
+   *
+   * @param p path to Stim or binary circuit file, or "-" to read Stim from
+   *          standard input
+   * @param seed seed for PRNG
+   * @param s storage scheme for the internal matrices (by default, chosen
+   *          according to the size and composition of the circuit)
+   *
+   * @throws std::runtime_error if the file cannot be opened
+   */
+  Simplex(const char *p, int seed = 0, storage s = storage::automatic);
+
+  /**
+   * Construct a simulator initialized in the all-zero state and apply the
+   * commands read from a stream in Stim format, as they are parsed.
+   *
+   * Qubits are added as they first appear in the stream.
+   *
+   * @param in input stream
    * @param seed seed for PRNG
+   * @param s storage scheme for the internal matrices
    */
-  Simplex(const char *p, int seed = 0);
+  Simplex(std::istream& in, int seed = 0, storage s = storage::automatic);
+
+  /**
+   * Construct a simulator initialized in the all-zero state and apply a list
+   * of parsed instructions.
+   *
+   * @param is instructions
+   * @param seed seed for PRNG
+   * @param s storage scheme for the internal matrices (by default, chosen
+   *          according to the size and composition of the circuit)
+   */
+  Simplex(const struct instrs& is, int seed = 0,
+    storage s = storage::automatic);
+
+  /**
+   * Simulate many independent shots of a circuit in parallel.
+   *
+   * Shots are simulated in batches of 64 (see SimplexBatch), each seeded
+   * from the base seed and the batch index, so the results do not depend on
+   * the number of threads.
+   *
+   * @param is instructions
+   * @param n_shots number of shots
+   * @param seed base seed for PRNG
+   * @param n_threads number of threads (0 for one per hardware thread)
+   * @param s storage scheme for the internal matrices (by default, chosen
+   *          according to the size and composition of the circuit)
+   *
+   * @return measurement results
+   */
+  static shot_results sample(const struct instrs& is, unsigned n_shots,
+    int seed = 0, unsigned n_threads = 0, storage s = storage::automatic);
 
   ~Simplex();
+
+  /**
+   * Copy a simulator.
+   *
+   * This takes constant time: the copies share their state until one of
+   * them applies an operation, when it takes its own copy of the parts it
+   * changes. With sparse, flat or hybrid storage these parts are blocks of
+   * 64 rows of the matrices, so that branches of a large state pay only for
+   * what they change; the dense layouts copy a whole matrix.
+   */
   Simplex(const Simplex& other);
   Simplex(Simplex&& other);
   Simplex& operator=(const Simplex& other);
@@ -178,7 +278,302 @@ public:
    */
   bool is_deterministic() const;
 
+  /**
+   * Sample the results of measuring every qubit in the Z basis, without
+   * changing the state.
+   *
+   * The results are uniformly distributed over the affine subspace
+   * {Ax + b}, so each shot costs one product of A with a random vector.
+   *
+   * @param n_shots number of shots
+   * @param seed seed for PRNG
+   *
+   * @return measurement results, the result for qubit j being measurement j
+   */
+  shot_results sample_all_z(unsigned n_shots, int seed = 0) const;
+
+  /**
+   * Sample the results of measuring every qubit, each in a given basis,
+   * without changing the state.
+   *
+   * The X and Y measurements are turned into Z measurements by basis
+   * changes applied once, to a copy of the state.
+   *
+   * @param bases one of 'X', 'Y' or 'Z' for each qubit
+   * @param n_shots number of shots
+   * @param seed seed for PRNG
+   *
+   * @return measurement results, the result for qubit j being measurement j
+   *
+   * @throws std::invalid_argument if there is not one valid basis per qubit
+   */
+  shot_results sample_all(
+    std::string_view bases, unsigned n_shots, int seed = 0) const;
+
 private:
   struct impl;
-  std::unique_ptr<impl> pImpl;
+  std::shared_ptr<impl> pImpl;
 };
+
+/**
+ * Clifford circuit simulator running 64 shots at once
+ *
+ * The shots share the parts of the state that do not depend on measurement
+ * outcomes, so that the work on them is done once for all 64. Measurements
+ * return a word whose bit i is the result in shot i.
+ */
+class SimplexBatch {
+public:
+  /**
+   * Construct a simulator initialized in the all-zero state.
+   *
+   * @param n number of qubits
+   * @param seed seed for PRNG
+   * @param s storage scheme for the internal matrices
+   */
+  SimplexBatch(unsigned n, int seed = 0, storage s = storage::automatic);
+
+  ~SimplexBatch();
+
+  /**
+   * Copy a simulator.
+   *
+   * As for Simplex, this takes constant time and the copies share their
+   * state until one of them changes it.
+   */
+  SimplexBatch(const SimplexBatch& other);
+  SimplexBatch(SimplexBatch&& other);
+  SimplexBatch& operator=(const SimplexBatch& other);
+  SimplexBatch& operator=(SimplexBatch&& other);
+
+  /**
+   * Get the number of qubits
+   *
+   * @return number of qubits
+   */
+  unsigned n() const;
+
+  /**
+   * Apply an X gate to every shot
+   *
+   * @param j qubit index
+   */
+  void X(unsigned j);
+
+  /**
+   * Apply a Y gate to every shot
+   *
+   * @param j qubit index
+   */
+  void Y(unsigned j);
+
+  /**
+   * Apply a Z gate to every shot
+   *
+   * @param j qubit index
+   */
+  void Z(unsigned j);
+
+  /**
+   * Apply an H gate to every shot
+   *
+   * @param j qubit index
+   */
+  void H(unsigned j);
+
+  /**
+   * Apply an S gate to every shot
+   *
+   * @param j qubit index
+   */
+  void S(unsigned j);
+
+  /**
+   * Apply an inverse-S gate to every shot
+   *
+   * @param j qubit index
+   */
+  void Sdg(unsigned j);
+
+  /**
+   * Apply a CX gate to every shot
+   *
+   * @param j index of control qubit
+   * @param k index of target qubit
+   */
+  void CX(unsigned j, unsigned k);
+
+  /**
+   * Apply a CZ gate to every shot
+   *
+   * @param j index of control qubit
+   * @param k index of target qubit
+   */
+  void CZ(unsigned j, unsigned k);
+
+  /**
+   * Measure a qubit in the X basis in every shot.
+   *
+   * If the measurement is non-deterministic, each shot gets its own result
+   * from the PRNG. A deterministic measurement may still give different
+   * results in different shots, according to their earlier results.
+   *
+   * @param j qubit index
+   *
+   * @return measurement results, bit i being the result in shot i
+   */
+  uint64_t MeasX(unsigned j);
+
+  /**
+   * Measure a qubit in the Y basis in every shot.
+   *
+   * If the measurement is non-deterministic, each shot gets its own result
+   * from the PRNG. A deterministic measurement may still give different
+   * results in different shots, according to their earlier results.
+   *
+   * @param j qubit index
+   *
+   * @return measurement results, bit i being the result in shot i
+   */
+  uint64_t MeasY(unsigned j);
+
+  /**
+   * Measure a qubit in the Z basis in every shot.
+   *
+   * If the measurement is non-deterministic, each shot gets its own result
+   * from the PRNG. A deterministic measurement may still give different
+   * results in different shots, according to their earlier results.
+   *
+   * @param j qubit index
+   *
+   * @return measurement results, bit i being the result in shot i
+   */
+  uint64_t MeasZ(unsigned j);
+
+  /**
+   * Reset a qubit in the X basis in every shot by measurement and
+   * conditional correction
+   *
+   * The correction is applied only in the shots whose measurement gave 1.
+   *
+   * @param j qubit index
+   */
+  void ResetX(unsigned j);
+
+  /**
+   * Reset a qubit in the Y basis in every shot by measurement and
+   * conditional correction
+   *
+   * The correction is applied only in the shots whose measurement gave 1.
+   *
+   * @param j qubit index
+   */
+  void ResetY(unsigned j);
+
+  /**
+   * Reset a qubit in the Z basis in every shot by measurement and
+   * conditional correction
+   *
+   * The correction is applied only in the shots whose measurement gave 1.
+   *
+   * @param j qubit index
+   */
+  void ResetZ(unsigned j);
+
+  /**
+   * Global phase of a shot, in units of pi/4
+   *
+   * @param i shot index
+   *
+   * @return an integer in the range [0,8) representing the global phase
+   */
+  int phase(unsigned i) const;
+
+  /**
+   * Determine whether all measurements in the circuit are deterministic
+   *
+   * @retval true all measurements are deterministic
+   * @retval false some measurements are non-deterministic
+   */
+  bool is_deterministic() const;
+
+private:
+  struct impl;
+  std::shared_ptr<impl> pImpl;
+};
+
+/**
+ * A circuit compiled for fast sampling
+ *
+ * The circuit is simulated once, with the result of each random measurement
+ * replaced by a new variable (a "coin"). Every measurement result is then an
+ * affine function of the coins over GF(2), so that a shot can be sampled by
+ * drawing random coins and evaluating these functions.
+ */
+class Sampler {
+public:
+  /**
+   * Compile a circuit.
+   *
+   * @param is instructions
+   * @param s storage scheme for the internal matrices used while compiling
+   *          (by default, chosen according to the size and composition of
+   *          the circuit)
+   */
+  Sampler(const struct instrs& is, storage s = storage::automatic);
+
+  /**
+   * Compile the circuit in a Stim-format (or binary circuit) file.
+   *
+   * @param p path to Stim or binary circuit file
+   * @param s storage scheme for the internal matrices used while compiling
+   */
+  Sampler(const char *p, storage s = storage::automatic);
+
+  /**
+   * Get the number of measurements in the circuit
+   *
+   * @return number of measurements
+   */
+  unsigned n_meas() const { return meas_count; }
+
+  /**
+   * Get the number of coins, i.e. of random measurements
+   *
+   * @return number of coins
+   */
+  unsigned n_coins() const { return coin_count; }
+
+  /**
+   * Compute the measurement results for given values of the coins.
+   *
+   * The coins are tossed in the order of the measurements, so this gives the
+   * same results as a simulation where the k-th random measurement returns
+   * coin k.
+   *
+   * @param coins coin values, bit k of word k / 64 being coin k
+   * @param results output: bit k of word k / 64 is set to the result of
+   *                measurement k
+   */
+  void evaluate(const uint64_t *coins, uint64_t *results) const;
+
+  /**
+   * Sample shots of the circuit.
+   *
+   * @param n_shots number of shots
+   * @param seed seed for PRNG
+   *
+   * @return measurement results
+   */
+  shot_results sample(unsigned n_shots, int seed = 0) const;
+
+private:
+  unsigned meas_count;
+  unsigned coin_count;
+  // Measurement k is the constant bit k of constant plus the coins
+  // vars[offset[k]], ..., vars[offset[k+1] - 1].
+  std::vector<uint64_t> constant;
+  std::vector<unsigned> offset;
+  std::vector<unsigned> vars;
+};
+
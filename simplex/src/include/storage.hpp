@@ -0,0 +1,13 @@
+#pragma once
+
+/**
+ * Storage scheme for the matrices in the simulator's state
+ */
+enum class storage {
+  automatic, // choose according to the build options and circuit
+  sparse,    // nonzero indices of each row in a balanced tree
+  flat,      // nonzero indices of each row in a sorted array
+  hybrid,    // each row a sorted array or a bitmap, according to its density
+  dense,     // one int per entry
+  packed     // one bit per entry, in 64-bit words
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#if defined(_WIN32)
+#include <fstream>
+#include <iterator>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Read-only view of the contents of a file, mapped into memory where the
+ * platform supports it and the file is a regular one (and otherwise read
+ * into a buffer, so that pipes work too).
+ *
+ * Throws std::runtime_error if the file cannot be opened.
+ */
+class mapped_file {
+public:
+  explicit mapped_file(const char *p) {
+#if defined(_WIN32)
+    std::ifstream file(p, std::ios::binary);
+    if (!file) {
+      throw std::runtime_error("Cannot open file: " + std::string(p));
+    }
+    buf.assign(
+      std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data = buf.data();
+    size = buf.size();
+#else
+    const int fd = ::open(p, O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Cannot open file: " + std::string(p));
+    }
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void* m = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m != MAP_FAILED) {
+        ::madvise(m, st.st_size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(m);
+        size = st.st_size;
+        mapped = true;
+      }
+    }
+    // Pipes and the like are read through the descriptor already open, since
+    // opening one again would wait for a new writer:
+    const bool ok = mapped || read_all(fd);
+    ::close(fd);
+    if (!ok) {
+      throw std::runtime_error("Cannot read file: " + std::string(p));
+    }
+#endif
+  }
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  ~mapped_file() {
+#if !defined(_WIN32)
+    if (mapped) ::munmap(const_cast<char*>(data), size);
+#endif
+  }
+
+  std::string_view contents() const { return {data, size}; }
+
+private:
+#if !defined(_WIN32)
+  // Read from a descriptor into buf until the end, returning false on error
+  bool read_all(int fd) {
+    char chunk[1 << 16];
+    for (;;) {
+      const ssize_t k = ::read(fd, chunk, sizeof(chunk));
+      if (k == 0) break;
+      if (k < 0) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      buf.append(chunk, k);
+    }
+    data = buf.data();
+    size = buf.size();
+    return true;
+  }
+
+  bool mapped = false;
+#endif
+
+  const char* data = nullptr;
+  std::size_t size = 0;
+  std::string buf;
+};
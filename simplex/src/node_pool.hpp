@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <set>
+#include <vector>
+
+/**
+ * A memory resource for the nodes of node-based containers.
+ *
+ * Small blocks are carved out of large chunks and recycled through one free
+ * list per size class, so allocation is a few instructions and nodes of the
+ * same container end up close together. Larger requests go to the global
+ * heap. All chunks are released at once when the resource is destroyed.
+ *
+ * Not thread-safe; each resource belongs to a single block of sets (see
+ * pooled_sets), which is only written by the matrix that owns it.
+ */
+class node_pool : public std::pmr::memory_resource {
+public:
+  node_pool() = default;
+  node_pool(const node_pool&) = delete;
+  node_pool& operator=(const node_pool&) = delete;
+
+  ~node_pool() {
+    for (void* c : chunks) {
+      ::operator delete(c);
+    }
+  }
+
+private:
+  static constexpr std::size_t granule = 16;
+  static constexpr std::size_t n_classes = 4; // blocks of up to 64 bytes
+  static constexpr std::size_t max_chunk = std::size_t(1) << 20;
+
+  struct free_block { free_block* next; };
+
+  // Size class for a request, or n_classes if it is not pooled
+  static std::size_t size_class(std::size_t bytes, std::size_t align) {
+    if (align > granule) return n_classes;
+    return std::min((bytes + granule - 1) / granule, n_classes + 1) - 1;
+  }
+
+  void* do_allocate(std::size_t bytes, std::size_t align) override {
+    const std::size_t k = size_class(bytes, align);
+    if (k >= n_classes) {
+      return std::pmr::new_delete_resource()->allocate(bytes, align);
+    }
+    if (free_block* b = free[k]) {
+      free[k] = b->next;
+      return b;
+    }
+    const std::size_t size = (k + 1) * granule;
+    if (std::size_t(end - cur) < size) {
+      cur = static_cast<char*>(::operator new(next_chunk));
+      end = cur + next_chunk;
+      chunks.push_back(cur);
+      next_chunk = std::min(2 * next_chunk, max_chunk);
+    }
+    void* p = cur;
+    cur += size;
+    return p;
+  }
+
+  void do_deallocate(void* p, std::size_t bytes, std::size_t align) override {
+    const std::size_t k = size_class(bytes, align);
+    if (k >= n_classes) {
+      std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+      return;
+    }
+    free[k] = new (p) free_block{free[k]};
+  }
+
+  bool do_is_equal(
+    const std::pmr::memory_resource& other) const noexcept override
+  {
+    return this == &other;
+  }
+
+  free_block* free[n_classes] = {};
+  char* cur = nullptr;
+  char* end = nullptr;
+  std::size_t next_chunk = 4096;
+  std::vector<void*> chunks;
+};
+
+/**
+ * A vector of sets of indices whose nodes come from a pool of its own, for use
+ * as a block of a cow_vector: a copy draws from a fresh pool, and the pool is
+ * held by pointer so that moving leaves the nodes where they are.
+ */
+struct pooled_sets {
+  using set = std::pmr::set<unsigned>;
+
+  pooled_sets() : pool(std::make_unique<node_pool>()), sets(pool.get()) {}
+  pooled_sets(const pooled_sets& other)
+    : pool(std::make_unique<node_pool>()), sets(other.sets, pool.get()) {}
+  pooled_sets(pooled_sets&& other) = default;
+  pooled_sets& operator=(const pooled_sets&) = delete;
+  pooled_sets& operator=(pooled_sets&&) = delete;
+
+  std::size_t size() const { return sets.size(); }
+  void resize(std::size_t k) { sets.resize(k); }
+
+  set& operator[](std::size_t i) { return sets[i]; }
+  const set& operator[](std::size_t i) const { return sets[i]; }
+
+  std::unique_ptr<node_pool> pool;
+  std::pmr::vector<set> sets;
+};
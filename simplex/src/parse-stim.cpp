@@ -1,199 +1,455 @@
 #include "parse-stim.hpp"
+#include "binary-circuit.hpp"
+#include "mapped_file.hpp"
+
 #include <algorithm>
-#include <fstream>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <initializer_list>
 #include <iostream>
-#include <iterator>
-#include <map>
-#include <sstream>
+#include <istream>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+namespace {
+
 struct opdatum {
   optype opt;
-  std::vector<unsigned> args;
+  unsigned args[2];
 };
 
+// Longest expansion of a Stim instruction
+constexpr unsigned max_expansion = 7;
+
 struct opdata {
+  constexpr opdata(
+    std::string_view name, unsigned arity, std::initializer_list<opdatum> ex)
+    : name(name), arity(arity), size(ex.size())
+  {
+    std::copy(ex.begin(), ex.end(), expansion);
+  }
+
+  std::string_view name;
   unsigned arity;
-  std::vector<opdatum> expansion;
+  unsigned size;
+  opdatum expansion[max_expansion] = {};
 };
 
-struct instrs parse_file(const char *p) {
-  static const std::map<std::string, struct opdata> opmap = {
-      {"I", {1, {}}},
-      {"X", {1, {{optype::X, {0}}}}},
-      {"Y", {1, {{optype::Y, {0}}}}},
-      {"Z", {1, {{optype::Z, {0}}}}},
-      {"C_XYZ", {1, {
-        {optype::Sdg, {0}},
-        {optype::H, {0}}}}},
-      {"C_ZYX", {1, {
-        {optype::H, {0}},
-        {optype::S, {0}}}}},
-      {"H", {1, {{optype::H, {0}}}}},
-      {"H_XY", {1, {
-        {optype::H, {0}},
-        {optype::Z, {0}},
-        {optype::H, {0}},
-        {optype::S, {0}}}}},
-      {"H_XZ", {1, {{optype::H, {0}}}}},
-      {"H_YZ", {1, {
-        {optype::H, {0}},
-        {optype::S, {0}},
-        {optype::H, {0}},
-        {optype::Z, {0}}}}},
-      {"S", {1, {{optype::S, {0}}}}},
-      {"SQRT_X", {1, {
-        {optype::H, {0}},
-        {optype::S, {0}},
-        {optype::H, {0}}}}},
-      {"SQRT_X_DAG", {1, {
-        {optype::S, {0}},
-        {optype::H, {0}},
-        {optype::S, {0}}}}},
-      {"SQRT_Y", {1, {
-        {optype::Z, {0}},
-        {optype::H, {0}}}}},
-      {"SQRT_Y_DAG", {1, {
-        {optype::H, {0}},
-        {optype::Z, {0}}}}},
-      {"SQRT_Z", {1, {{optype::S, {0}}}}},
-      {"SQRT_Z_DAG", {1, {{optype::Sdg, {0}}}}},
-      {"S_DAG", {1, {{optype::Sdg, {0}}}}},
-      {"CNOT", {2, {{optype::CX, {0, 1}}}}},
-      {"CX", {2, {{optype::CX, {0, 1}}}}},
-      {"CY", {2, {
-        {optype::Sdg, {1}},
-        {optype::CX, {0, 1}},
-        {optype::S, {1}}}}},
-      {"CZ", {2, {{optype::CZ, {0, 1}}}}},
-      {"ISWAP", {2, {
-        {optype::CX, {0, 1}},
-        {optype::S, {1}},
-        {optype::CX, {1, 0}},
-        {optype::CX, {0, 1}}}}},
-      {"ISWAP_DAG", {2, {
-        {optype::CX, {0, 1}},
-        {optype::Sdg, {1}},
-        {optype::CX, {1, 0}},
-        {optype::CX, {0, 1}}}}},
-      {"SQRT_XX", {2, {
-        {optype::CX, {0, 1}},
-        {optype::H, {0}},
-        {optype::S, {0}},
-        {optype::H, {0}},
-        {optype::CX, {0, 1}}}}},
-      {"SQRT_XX_DAG", {2, {
-        {optype::S, {0}},
-        {optype::CX, {0, 1}},
-        {optype::H, {0}},
-        {optype::S, {0}},
-        {optype::CX, {0, 1}}}}},
-      {"SQRT_YY", {2, {
-        {optype::S, {0}},
-        {optype::CX, {1, 0}},
-        {optype::Z, {0}},
-        {optype::H, {1}},
-        {optype::CX, {1, 0}},
-        {optype::S, {0}}}}},
-      {"SQRT_YY_DAG", {2, {
-        {optype::CX, {0, 1}},
-        {optype::S, {1}},
-        {optype::H, {0}},
-        {optype::S, {0}},
-        {optype::H, {0}},
-        {optype::CX, {1, 0}},
-        {optype::CX, {0, 1}}}}},
-      {"SQRT_ZZ", {2, {
-        {optype::CX, {0, 1}},
-        {optype::S, {1}},
-        {optype::CX, {0, 1}}}}},
-      {"SQRT_ZZ_DAG", {2, {
-        {optype::H, {1}},
-        {optype::CX, {0, 1}},
-        {optype::H, {1}},
-        {optype::Sdg, {0}},
-        {optype::Sdg, {1}}}}},
-      {"SWAP", {2, {
-        {optype::CX, {0, 1}},
-        {optype::CX, {1, 0}},
-        {optype::CX, {0, 1}}}}},
-      {"XCX", {2, {
-        {optype::H, {0}},
-        {optype::CX, {0, 1}},
-        {optype::H, {0}}}}},
-      {"XCY", {2, {
-        {optype::CX, {0, 1}},
-        {optype::H, {0}},
-        {optype::S, {0}},
-        {optype::CX, {0, 1}},
-        {optype::H, {0}}}}},
-      {"XCZ", {2, {{optype::CX, {1, 0}}}}},
-      {"YCX", {2, {
-        {optype::CX, {0, 1}},
-        {optype::H, {1}},
-        {optype::S, {1}},
-        {optype::CX, {1, 0}},
-        {optype::H, {1}}}}},
-      {"YCY", {2, {
-        {optype::H, {0}},
-        {optype::S, {0}},
-        {optype::H, {0}},
-        {optype::CX, {0, 1}},
-        {optype::H, {0}},
-        {optype::CX, {1, 0}},
-        {optype::S, {0}}}}},
-      {"YCZ", {2, {
-        {optype::Sdg, {0}},
-        {optype::CX, {1, 0}},
-        {optype::S, {0}}}}},
-      {"ZCX", {2, {{optype::CX, {0, 1}}}}},
-      {"ZCY", {2, {
-        {optype::Sdg, {1}},
-        {optype::CX, {0, 1}},
-        {optype::S, {1}}}}},
-      {"ZCZ", {2, {{optype::CZ, {0, 1}}}}},
-      {"M", {1, {{optype::MeasZ, {0}}}}},
-      {"MX", {1, {{optype::MeasX, {0}}}}},
-      {"MY", {1, {{optype::MeasY, {0}}}}},
-      {"MZ", {1, {{optype::MeasZ, {0}}}}},
-      {"R", {1, {{optype::ResetZ, {0}}}}},
-      {"RX", {1, {{optype::ResetX, {0}}}}},
-      {"RY", {1, {{optype::ResetY, {0}}}}},
-      {"RZ", {1, {{optype::ResetZ, {0}}}}},
-      {"tick", {0, {}}}
-  };
-
-  std::ifstream file(p);
+constexpr opdata opdatas[] = {
+    {"I", 1, {}},
+    {"X", 1, {{optype::X, {0}}}},
+    {"Y", 1, {{optype::Y, {0}}}},
+    {"Z", 1, {{optype::Z, {0}}}},
+    {"C_XYZ", 1, {
+      {optype::Sdg, {0}},
+      {optype::H, {0}}}},
+    {"C_ZYX", 1, {
+      {optype::H, {0}},
+      {optype::S, {0}}}},
+    {"H", 1, {{optype::H, {0}}}},
+    {"H_XY", 1, {
+      {optype::H, {0}},
+      {optype::Z, {0}},
+      {optype::H, {0}},
+      {optype::S, {0}}}},
+    {"H_XZ", 1, {{optype::H, {0}}}},
+    {"H_YZ", 1, {
+      {optype::H, {0}},
+      {optype::S, {0}},
+      {optype::H, {0}},
+      {optype::Z, {0}}}},
+    {"S", 1, {{optype::S, {0}}}},
+    {"SQRT_X", 1, {
+      {optype::H, {0}},
+      {optype::S, {0}},
+      {optype::H, {0}}}},
+    {"SQRT_X_DAG", 1, {
+      {optype::S, {0}},
+      {optype::H, {0}},
+      {optype::S, {0}}}},
+    {"SQRT_Y", 1, {
+      {optype::Z, {0}},
+      {optype::H, {0}}}},
+    {"SQRT_Y_DAG", 1, {
+      {optype::H, {0}},
+      {optype::Z, {0}}}},
+    {"SQRT_Z", 1, {{optype::S, {0}}}},
+    {"SQRT_Z_DAG", 1, {{optype::Sdg, {0}}}},
+    {"S_DAG", 1, {{optype::Sdg, {0}}}},
+    {"CNOT", 2, {{optype::CX, {0, 1}}}},
+    {"CX", 2, {{optype::CX, {0, 1}}}},
+    {"CY", 2, {
+      {optype::Sdg, {1}},
+      {optype::CX, {0, 1}},
+      {optype::S, {1}}}},
+    {"CZ", 2, {{optype::CZ, {0, 1}}}},
+    {"ISWAP", 2, {
+      {optype::CX, {0, 1}},
+      {optype::S, {1}},
+      {optype::CX, {1, 0}},
+      {optype::CX, {0, 1}}}},
+    {"ISWAP_DAG", 2, {
+      {optype::CX, {0, 1}},
+      {optype::Sdg, {1}},
+      {optype::CX, {1, 0}},
+      {optype::CX, {0, 1}}}},
+    {"SQRT_XX", 2, {
+      {optype::CX, {0, 1}},
+      {optype::H, {0}},
+      {optype::S, {0}},
+      {optype::H, {0}},
+      {optype::CX, {0, 1}}}},
+    {"SQRT_XX_DAG", 2, {
+      {optype::S, {0}},
+      {optype::CX, {0, 1}},
+      {optype::H, {0}},
+      {optype::S, {0}},
+      {optype::CX, {0, 1}}}},
+    {"SQRT_YY", 2, {
+      {optype::S, {0}},
+      {optype::CX, {1, 0}},
+      {optype::Z, {0}},
+      {optype::H, {1}},
+      {optype::CX, {1, 0}},
+      {optype::S, {0}}}},
+    {"SQRT_YY_DAG", 2, {
+      {optype::CX, {0, 1}},
+      {optype::S, {1}},
+      {optype::H, {0}},
+      {optype::S, {0}},
+      {optype::H, {0}},
+      {optype::CX, {1, 0}},
+      {optype::CX, {0, 1}}}},
+    {"SQRT_ZZ", 2, {
+      {optype::CX, {0, 1}},
+      {optype::S, {1}},
+      {optype::CX, {0, 1}}}},
+    {"SQRT_ZZ_DAG", 2, {
+      {optype::H, {1}},
+      {optype::CX, {0, 1}},
+      {optype::H, {1}},
+      {optype::Sdg, {0}},
+      {optype::Sdg, {1}}}},
+    {"SWAP", 2, {
+      {optype::CX, {0, 1}},
+      {optype::CX, {1, 0}},
+      {optype::CX, {0, 1}}}},
+    {"XCX", 2, {
+      {optype::H, {0}},
+      {optype::CX, {0, 1}},
+      {optype::H, {0}}}},
+    {"XCY", 2, {
+      {optype::CX, {0, 1}},
+      {optype::H, {0}},
+      {optype::S, {0}},
+      {optype::CX, {0, 1}},
+      {optype::H, {0}}}},
+    {"XCZ", 2, {{optype::CX, {1, 0}}}},
+    {"YCX", 2, {
+      {optype::CX, {0, 1}},
+      {optype::H, {1}},
+      {optype::S, {1}},
+      {optype::CX, {1, 0}},
+      {optype::H, {1}}}},
+    {"YCY", 2, {
+      {optype::H, {0}},
+      {optype::S, {0}},
+      {optype::H, {0}},
+      {optype::CX, {0, 1}},
+      {optype::H, {0}},
+      {optype::CX, {1, 0}},
+      {optype::S, {0}}}},
+    {"YCZ", 2, {
+      {optype::Sdg, {0}},
+      {optype::CX, {1, 0}},
+      {optype::S, {0}}}},
+    {"ZCX", 2, {{optype::CX, {0, 1}}}},
+    {"ZCY", 2, {
+      {optype::Sdg, {1}},
+      {optype::CX, {0, 1}},
+      {optype::S, {1}}}},
+    {"ZCZ", 2, {{optype::CZ, {0, 1}}}},
+    {"M", 1, {{optype::MeasZ, {0}}}},
+    {"MX", 1, {{optype::MeasX, {0}}}},
+    {"MY", 1, {{optype::MeasY, {0}}}},
+    {"MZ", 1, {{optype::MeasZ, {0}}}},
+    {"R", 1, {{optype::ResetZ, {0}}}},
+    {"RX", 1, {{optype::ResetX, {0}}}},
+    {"RY", 1, {{optype::ResetY, {0}}}},
+    {"RZ", 1, {{optype::ResetZ, {0}}}},
+    {"tick", 0, {}}
+};
+
+/*
+ * Instruction names are looked up in a table indexed by a hash that has no
+ * collisions between the names above.
+ */
+
+constexpr std::size_t table_bits = 8;
+constexpr std::size_t table_size = std::size_t(1) << table_bits;
+
+constexpr uint32_t name_hash(std::string_view s, uint32_t seed) {
+  uint32_t h = seed;
+  for (char c : s) {
+    h = (h ^ uint8_t(c)) * 16777619u;
+  }
+  return (h ^ (h >> 16)) & (table_size - 1);
+}
+
+constexpr bool is_collision_free(uint32_t seed) {
+  bool used[table_size] = {};
+  for (const opdata& d : opdatas) {
+    const uint32_t k = name_hash(d.name, seed);
+    if (used[k]) return false;
+    used[k] = true;
+  }
+  return true;
+}
+
+// The first seed counting up from the FNV offset basis that works; a new
+// instruction name may need a new one.
+constexpr uint32_t hash_seed = 2166136489u;
+static_assert(is_collision_free(hash_seed), "hash_seed gives collisions");
+
+// Index into opdatas plus 1, or 0 for an empty slot
+constexpr std::array<uint8_t, table_size> make_slots() {
+  std::array<uint8_t, table_size> slots = {};
+  for (std::size_t i = 0; i < std::size(opdatas); i++) {
+    slots[name_hash(opdatas[i].name, hash_seed)] = i + 1;
+  }
+  return slots;
+}
+
+constexpr std::array<uint8_t, table_size> slots = make_slots();
+
+const opdata& lookup(std::string_view name) {
+  const uint8_t i = slots[name_hash(name, hash_seed)];
+  if (i == 0 || opdatas[i - 1].name != name) {
+    throw std::out_of_range("Unknown instruction: " + std::string(name));
+  }
+  return opdatas[i - 1];
+}
+
+// Same characters as std::isspace in the "C" locale
+constexpr bool is_space(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Return the next whitespace-delimited token in [it, end), advancing it past
+// the token, or an empty view if there is none
+std::string_view next_token(const char *&it, const char *end) {
+  while (it != end && is_space(*it)) it++;
+  const char *start = it;
+  while (it != end && !is_space(*it)) it++;
+  return {start, std::size_t(it - start)};
+}
+
+// Parse a qubit index as std::stoul would
+unsigned parse_index(std::string_view tok) {
+  const char *first = tok.data();
+  const char *last = first + tok.size();
+  bool neg = false;
+  if (first != last && (*first == '+' || *first == '-')) {
+    neg = (*first == '-');
+    first++;
+  }
+  unsigned long k;
+  const auto [ptr, ec] = std::from_chars(first, last, k);
+  if (ec == std::errc::invalid_argument) {
+    throw std::invalid_argument("stoul");
+  }
+  if (ec == std::errc::result_out_of_range) {
+    throw std::out_of_range("stoul");
+  }
+  return neg ? unsigned(-k) : unsigned(k);
+}
+
+// Number of qubits an operation acts on
+unsigned arity(optype t) {
+  return (t == optype::CX || t == optype::CZ) ? 2 : 1;
+}
+
+// Parse a line, updating the largest qubit index max_n and calling f(op) for
+// each operation in its expansion
+template <typename F>
+void parse_line(std::string_view line, unsigned &max_n, F f) {
+  const char *tok = line.data();
+  const char *const eol = tok + line.size();
+  const std::string_view opname = next_token(tok, eol);
+  if (opname.empty()) return;
+  const opdata &opda = lookup(opname);
+  const unsigned n_args = opda.arity;
+  // The arguments, and one more token if there is one:
+  std::string_view args[3];
+  unsigned n_tokens = 0;
+  while (n_tokens <= n_args) {
+    args[n_tokens] = next_token(tok, eol);
+    if (args[n_tokens].empty()) break;
+    n_tokens++;
+  }
+  if (n_tokens != n_args) {
+    std::cerr << "Cannot parse line: " << line << std::endl;
+    throw;
+  }
+  unsigned qubits[2];
+  for (unsigned i = 0; i < n_args; i++) {
+    unsigned k = parse_index(args[i]);
+    if (k > max_n) max_n = k;
+    qubits[i] = k;
+  }
+  for (unsigned e = 0; e < opda.size; e++) {
+    const opdatum &opdm = opda.expansion[e];
+    f(op{opdm.opt, {
+      qubits[opdm.args[0]],
+      arity(opdm.opt) == 2 ? qubits[opdm.args[1]] : 0}});
+  }
+}
+
+// Operations are stored inline, without allocation:
+static_assert(sizeof(struct op) == 12);
+
+// Bytes read from a stream at a time
+constexpr std::size_t chunk_size = std::size_t(1) << 16;
+
+} // namespace
+
+struct stim_reader::impl {
+  impl(std::istream &in) : in(&in) {}
+
+  impl(const char *p)
+    : in(nullptr), file(std::make_unique<mapped_file>(p)),
+    text(file->contents()) {}
+
+  /* Data */
+
+  // Source: either a stream, read a chunk at a time into buf, or a mapped file
+  std::istream *in;
+  std::unique_ptr<mapped_file> file;
+  std::vector<char> buf;
+  // Input not yet parsed (in buf or file)
+  std::string_view text;
   unsigned max_n = 0;
-  std::vector<struct op> ops;
-  std::string line;
-  while (std::getline(file, line)) {
-    std::istringstream iss(line);
-    std::vector<std::string> tokens(
-      std::istream_iterator<std::string>(iss),
-      std::istream_iterator<std::string>{});
-    if (tokens.empty()) continue;
-    const std::string &opname = tokens[0];
-    struct opdata opda = opmap.at(opname);
-    unsigned n_args = opda.arity;
-    if (tokens.size() != 1 + n_args) {
-      std::cerr << "Cannot parse line: " << line << std::endl;
-      throw;
+  // Operations parsed but not yet returned (a line, or a whole repeat block)
+  std::vector<struct op> pending;
+  std::size_t i_pending = 0;
+  // The outermost repeat block being parsed, and the positions in it of the
+  // headers of the blocks still open
+  std::vector<struct op> block;
+  std::vector<std::size_t> open;
+
+  /* Methods */
+
+  // Parse a line, adding its operations to pending or to the open block
+  void parse(std::string_view line) {
+    const char *tok = line.data();
+    const char *const eol = tok + line.size();
+    const std::string_view first = next_token(tok, eol);
+    if (first == "REPEAT") {
+      const std::string_view count = next_token(tok, eol);
+      const std::string_view brace = next_token(tok, eol);
+      if (count.empty() || brace != "{" || !next_token(tok, eol).empty()) {
+        throw std::invalid_argument("Cannot parse line: " + std::string(line));
+      }
+      open.push_back(block.size());
+      block.push_back({optype::Repeat, {parse_index(count), 0}});
+    } else if (first == "}") {
+      if (open.empty() || !next_token(tok, eol).empty()) {
+        throw std::invalid_argument("Cannot parse line: " + std::string(line));
+      }
+      struct op &header = block[open.back()];
+      header.qubits[1] = block.size() - open.back() - 1;
+      open.pop_back();
+      if (open.empty()) {
+        pending.insert(pending.end(), block.begin(), block.end());
+        block.clear();
+      }
+    } else {
+      std::vector<struct op> &out = open.empty() ? pending : block;
+      parse_line(line, max_n, [&](const struct op &e) { out.push_back(e); });
     }
-    std::vector<unsigned> qubits(n_args);
-    for (unsigned i = 0; i < n_args; i++) {
-      unsigned k = std::stoul(tokens[1 + i]);
-      if (k > max_n) max_n = k;
-      qubits[i] = k;
+  }
+
+  // Read another chunk of the stream after the unparsed input, returning
+  // false at the end of the stream
+  bool refill() {
+    if (!in || !*in) return false;
+    const std::size_t keep = text.size();
+    std::copy(text.begin(), text.end(), buf.begin());
+    buf.resize(keep + chunk_size);
+    in->read(buf.data() + keep, chunk_size);
+    buf.resize(keep + in->gcount());
+    text = {buf.data(), buf.size()};
+    return buf.size() > keep;
+  }
+
+  // Take the next line of input, returning false if there is none
+  bool next_line(std::string_view &line) {
+    std::size_t eol;
+    while ((eol = text.find('\n')) == std::string_view::npos) {
+      if (!refill()) {
+        if (text.empty()) return false;
+        line = text;
+        text = {};
+        return true;
+      }
     }
-    for (const struct opdatum &opdm : opda.expansion) {
-      std::vector<unsigned> qbs(n_args);
-      for (unsigned i = 0; i < n_args; i++) {
-        qbs[i] = qubits[opdm.args[i]];
+    line = text.substr(0, eol);
+    text.remove_prefix(eol + 1);
+    return true;
+  }
+};
+
+stim_reader::stim_reader(std::istream &in)
+  : pImpl(std::make_unique<impl>(in)) {}
+
+stim_reader::stim_reader(const char *p)
+  : pImpl(std::make_unique<impl>(p)) {}
+
+stim_reader::~stim_reader() = default;
+
+bool stim_reader::next(struct op &o) {
+  impl &I = *pImpl;
+  while (I.i_pending == I.pending.size()) {
+    std::string_view line;
+    if (!I.next_line(line)) {
+      if (!I.open.empty()) {
+        throw std::invalid_argument("Unterminated REPEAT block");
       }
-      ops.push_back({opdm.opt, qbs});
+      return false;
     }
+    I.pending.clear();
+    I.i_pending = 0;
+    I.parse(line);
+  }
+  o = I.pending[I.i_pending++];
+  return true;
+}
+
+void stim_reader::read_body(const struct op &o, std::vector<struct op> &body) {
+  // The whole block was parsed with its header.
+  impl &I = *pImpl;
+  body.assign(
+    I.pending.begin() + I.i_pending,
+    I.pending.begin() + I.i_pending + o.qubits[1]);
+  I.i_pending += o.qubits[1];
+}
+
+unsigned stim_reader::n() const { return pImpl->max_n + 1; }
+
+struct instrs parse_file(const char *p) {
+  if (is_binary_circuit(p)) {
+    const binary_circuit c(p);
+    return {c.n(), {c.ops().begin(), c.ops().end()}};
+  }
+  stim_reader in(p);
+  std::vector<struct op> ops;
+  struct op o;
+  while (in.next(o)) {
+    ops.push_back(o);
   }
-  return {max_n + 1, ops};
+  return {in.n(), std::move(ops)};
 }
@@ -1,461 +1,537 @@
 #include "simplex.hpp"
-#include "A_matrix.hpp"
-#include "Q_matrix.hpp"
-#include "bimap.hpp"
+#include "binary-circuit.hpp"
+#include "bits.hpp"
+#include "cow.hpp"
+#include "engine.hpp"
 #include "parse-stim.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <random>
-#include <set>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
 /* Implementation */
 
-class RBG {
-public:
-  RBG(int seed = 0) : gen(seed), distrib(0, 1) {}
-  int get() { return distrib(gen); }
-private:
-  std::mt19937 gen;
-  std::uniform_int_distribution<> distrib;
-};
+// Storage scheme fixed by the build options, if any
+#if defined (SIMPLEX_PACKED)
+static constexpr storage build_storage = storage::packed;
+#elif defined (SIMPLEX_FLAT)
+static constexpr storage build_storage = storage::flat;
+#elif defined (SIMPLEX_HYBRID)
+static constexpr storage build_storage = storage::hybrid;
+#elif defined (SIMPLEX_DENSE)
+static constexpr storage build_storage = storage::dense;
+#else
+static constexpr storage build_storage = storage::automatic;
+#endif
+
+static storage choose_storage(storage s) {
+  if (s != storage::automatic) return s;
+  if (build_storage != storage::automatic) return build_storage;
+  return storage::sparse;
+}
 
-struct Simplex::impl {
-  impl(unsigned n, int seed = 0)
-    : n(n), r(0), A(n), b(n, 0), Q(n), R0(n+1, 0), R1(n+1, 0), p(), g(0),
-    deterministic(true), rbg(seed) {}
-
-  impl(struct instrs is, int seed = 0) : impl(is.n, seed) {
-    for (const auto &op : is.ops) {
-      switch (op.type) {
-        case optype::X: SimulateX(op.qubits[0]); break;
-        case optype::Y: SimulateY(op.qubits[0]); break;
-        case optype::Z: SimulateZ(op.qubits[0]); break;
-        case optype::H: SimulateH(op.qubits[0]); break;
-        case optype::S: SimulateS(op.qubits[0]); break;
-        case optype::Sdg: SimulateSdg(op.qubits[0]); break;
-        case optype::CX: SimulateCX(op.qubits[0], op.qubits[1]); break;
-        case optype::CZ: SimulateCZ(op.qubits[0], op.qubits[1]); break;
-        case optype::MeasX: SimulateMeasX(op.qubits[0]); break;
-        case optype::MeasY: SimulateMeasY(op.qubits[0]); break;
-        case optype::MeasZ: SimulateMeasZ(op.qubits[0]); break;
-        case optype::ResetX: SimulateResetX(op.qubits[0]); break;
-        case optype::ResetY: SimulateResetY(op.qubits[0]); break;
-        case optype::ResetZ: SimulateResetZ(op.qubits[0]); break;
-        default:
-          std::cerr << "Unrecognized operation" << std::endl;
-          throw;
-      }
+// Qubit count above which the quadratic memory of packed storage is too much
+static constexpr unsigned max_packed_n = 16384;
+
+// Counts of the kinds of operation in a circuit, from which to choose a
+// storage scheme
+struct circuit_stats {
+  std::size_t n_ops = 0, n_spread = 0, n_collapse = 0;
+  // Number of two-qubit gates by the distance between their qubits
+  std::vector<std::size_t> n_2q_at;
+
+  // Count an operation executed a number of times
+  void add(const struct op& op, uint64_t times = 1) {
+    n_ops += times;
+    // The matrices fill up when many gates create new columns (H and non-Z
+    // measurements) or mix rows (two-qubit gates), especially if the
+    // two-qubit gates are non-local; Z measurements and resets tend to
+    // remove columns again.
+    switch (op.type) {
+      case optype::CX:
+      case optype::CZ: {
+        unsigned j = op.qubits[0], k = op.qubits[1];
+        const unsigned d = j > k ? j - k : k - j;
+        if (d >= n_2q_at.size()) n_2q_at.resize(d + 1);
+        n_2q_at[d] += times;
+      } [[fallthrough]];
+      case optype::H:
+      case optype::MeasX:
+      case optype::MeasY:
+        n_spread += times;
+        break;
+      case optype::MeasZ:
+      case optype::ResetX:
+      case optype::ResetY:
+      case optype::ResetZ:
+        n_collapse += times;
+        break;
+      default:
+        break;
     }
   }
 
-  impl(const char *p, int seed = 0)
-    : impl(parse_file(p), seed) {}
-
-  /* Data */
-
-  unsigned n;
-  unsigned r;
-  A_matrix A;
-  std::vector<int> b;
-  Q_matrix Q;
-  std::vector<int> R0;
-  std::vector<int> R1;
-  Bimap p;
-  int g;
-  bool deterministic;
-  RBG rbg;
-
-  /* Methods */
-
-  void ReindexSubtColumn(unsigned k, unsigned c) {
-    if (k == c) return;
-    A.add_col(k, c);
-    int R0k = R0[k];
-    int R0c = R0[c];
-    int Qkc = Q.entry(k, c);
-    Q.add_rowcol(k, c);
-    if (R0c) {
-      Q.flip_submatrix({k, c});
-    }
-    R0[k] ^= R0c;
-    R1[k] ^= R1[c] ^ Qkc ^ (R0k & R0c);
+  // Count the operations in a list, as many times as they are executed
+  void add_all(std::span<const struct op> ops, uint64_t times = 1) {
+    for_each_op(ops, [&](const struct op& op, uint64_t k) {
+      add(op, k);
+    }, times);
   }
 
-  void MakePrincipal(unsigned c, unsigned j) {
-    if (A.entry(j, c)) {
-      const std::set<unsigned> H = A.cols_where_one(j);
-      for (unsigned k : H) {
-        if (k != c) {
-          // This modifies A[j][k] but no other entries in A_j:
-          ReindexSubtColumn(k, c);
-        }
-      }
-      p.make_match(c, j);
+  // Storage scheme for a circuit on n qubits
+  storage choose(unsigned n) const {
+    if (n <= 256) return storage::packed;
+    std::size_t n_2q = 0, n_far = 0;
+    for (unsigned d = 0; d < n_2q_at.size(); d++) {
+      n_2q += n_2q_at[d];
+      if (16 * d > n) n_far += n_2q_at[d];
     }
-  }
-
-  void ReselectPrincipalRow(
-    unsigned c, std::optional<unsigned> j = std::nullopt)
-  {
-    std::optional<unsigned> n0;
-    unsigned j0;
-    for (unsigned j1 = 0; j1 < n; j1++) {
-      if (!j || j1 != *j) {
-        if (A.entry(j1, c)) {
-          unsigned n1 = A.row_weight(j1);
-          if (!n0 || n1 < *n0) {
-            j0 = j1;
-            n0 = n1;
-          }
-        }
-      }
+    if (n <= max_packed_n && 2 * n_far >= n_2q &&
+        n_spread >= 4 * (n + n_collapse)) {
+      return storage::packed;
     }
-    if (n0) {
-      MakePrincipal(c, j0);
-    }
-  }
-
-  std::optional<unsigned> principate(unsigned j) {
-    std::optional<unsigned> c = p.inv_at(j);
-    if (c) {
-      ReselectPrincipalRow(*c, j);
-      if (j != *p.fwd_at(*c)) {
-        c = std::nullopt;
-      }
-    }
-    return c;
+    return (20 * n_collapse < n_ops) ? storage::hybrid : storage::sparse;
   }
+};
 
-  // Swap column k with column r-1
-  void ReindexSwapColumn(unsigned k) {
-    const unsigned r1 = r - 1;
-    if (k == r1) return;
-    A.swap_col(k);
-    std::iter_swap(R0.begin() + k, R0.begin() + r1);
-    std::iter_swap(R1.begin() + k, R1.begin() + r1);
-    Q.swap_rowcol(k);
-    p.swap_fwd(k, r1);
+static storage choose_storage(
+  storage s, unsigned n, std::span<const struct op> ops)
+{
+  if (s != storage::automatic || build_storage != storage::automatic) {
+    return choose_storage(s);
   }
+  circuit_stats stats;
+  stats.add_all(ops);
+  return stats.choose(n);
+}
 
-  void expand(unsigned j, const std::set<unsigned>& H) {
-    A.zero_append_basis_col(j);
-    Q.append_rowcol(H);
-    r++;
-  }
+static storage choose_storage(storage s, const struct instrs& is) {
+  return choose_storage(s, is.n, is.ops);
+}
 
-  void contract() {
-    A.drop_final_col();
-    Q.drop_final_rowcol();
-    p.fwd_erase(r - 1);
-    r--;
+// Qubit count and storage scheme for the circuit in a Stim file, read
+// without keeping its instructions
+static std::pair<unsigned, storage> scan_file(const char *p, storage s) {
+  stim_reader in(p);
+  struct op op;
+  if (s != storage::automatic || build_storage != storage::automatic) {
+    while (in.next(op)) {}
+    return {in.n(), choose_storage(s)};
   }
-
-  void FixFinalBit(int z) {
-    if (z) {
-      const unsigned r1 = r - 1;
-      for (unsigned j = 0; j < n; j++) {
-        b[j] ^= A.entry(j, r1);
-      }
-      for (unsigned h = 0; h < r1; h++) {
-        R1[h] ^= Q.entry(h, r1);
-      }
-      if (z) {
-        if (R0[r1]) g += 2;
-        if (R1[r1]) g += 4;
-        g %= 8;
-      }
+  circuit_stats stats;
+  std::vector<struct op> body;
+  while (in.next(op)) {
+    if (op.type == optype::Repeat) {
+      in.read_body(op, body);
+      stats.add_all(body, op.qubits[0]);
+    } else {
+      stats.add(op);
     }
-    contract();
   }
+  return {in.n(), stats.choose(in.n())};
+}
 
-  void ZeroColumnElim(unsigned c) {
-    ReindexSwapColumn(c);
-    const std::set<unsigned> H = Q.rows_with_terminal_1();
-    int u0 = R0[r - 1];
-    int u1 = R1[r - 1];
-    contract();
-    if (u0) {
-      Q.flip_submatrix(H);
-      for (unsigned h : H) {
-        R0[h] ^= 1;
-        R1[h] ^= R0[h] ^ u1;
-      }
-      g += 2;
-      if (u0) g += 7;
-      if (u1) g += 6;
-      g %= 8;
-    } else if (!H.empty()) {
-      unsigned l = *H.begin();
-      for (unsigned h : H) {
-        ReindexSubtColumn(h, l);
-      }
-      ReindexSwapColumn(l);
-      FixFinalBit(u1);
-    }
-  }
+struct Simplex::impl : engine<bit_values> {
+  impl(unsigned n, int seed = 0, storage s = storage::sparse)
+    : engine(n, seed, s) {}
 
-  void new_principal_column(
-    unsigned j,
-    int r0, int r1,
-    std::optional<unsigned> c = std::nullopt,
-    const std::set<unsigned>& H = std::set<unsigned>())
+  impl(const struct instrs& is, int seed = 0, storage s = storage::automatic)
+    : impl(is.n, seed, choose_storage(s, is))
   {
-    expand(j, H);
-    b[j] = 0;
-    R0[r - 1] = r0;
-    R1[r - 1] = r1;
-    p.make_match(r - 1, j);
-    if (c) {
-      ZeroColumnElim(*c);
-    }
-  }
-
-  void SimulateX(unsigned j) { b[j] ^= 1; }
-
-  void SimulateY(unsigned j) {
-    g += 2; g %= 8;
-    SimulateZ(j); SimulateX(j);
-  }
-
-  void SimulateZ(unsigned j) {
-    if (b[j]) {
-      g += 4; g %= 8;
-    }
-    const std::set<unsigned> H = A.cols_where_one(j);
-    for (unsigned h : H) {
-      R1[h] ^= 1;
-    }
+    run(is, [](int) {});
   }
 
-  void SimulateH(unsigned j) {
-    std::optional<unsigned> c = principate(j);
-    const std::set<unsigned> H = A.cols_where_one(j);
-    new_principal_column(j, 0, b[j], c, H);
-  }
+  // The (regular) file is read twice: once to size the matrices and choose
+  // the storage, and once to run the instructions as they are parsed.
+  impl(const char *p, int seed = 0, storage s = storage::automatic)
+    : impl(scan_file(p, s), p, seed) {}
 
-  void SimulateS(unsigned j) {
-    const std::set<unsigned> H = A.cols_where_one(j);
-    Q.flip_submatrix(H);
-    int z = b[j];
-    for (unsigned h : H) {
-      R1[h] ^= R0[h] ^ z;
-      R0[h] ^= 1;
-    }
-    if (z) {
-      g += 2; g %= 8;
-    }
-  }
-
-  void SimulateSdg(unsigned j) {
-    const std::set<unsigned> H = A.cols_where_one(j);
-    Q.flip_submatrix(H);
-    const int z = b[j];
-    for (unsigned h : H) {
-      R0[h] ^= 1;
-      R1[h] ^= R0[h] ^ z;
-    }
-    if (z) {
-      g += 6; g %= 8;
-    }
-  }
-
-  void SimulateCX(unsigned j, unsigned k) {
-    A.add_row(k, j);
-    b[k] ^= b[j];
-    std::optional<unsigned> c = p.inv_at(k);
-    if (c) {
-      ReselectPrincipalRow(*c);
-    }
-  }
-
-  void SimulateCZ(unsigned j, unsigned k) {
-    const std::set<unsigned> H_j = A.cols_where_one(j);
-    const std::set<unsigned> H_k = A.cols_where_one(k);
-    Q.flip_submatrix(H_j, H_k);
-    const std::set<unsigned> H_jk = A.cols_where_one(j, k);
-    for (unsigned h : H_jk) {
-      R1[h] ^= 1;
-    }
-    const int z_j = b[j];
-    const int z_k = b[k];
-    for (unsigned h : H_j) {
-      R1[h] ^= z_k;
-    }
-    for (unsigned h : H_k) {
-      R1[h] ^= z_j;
-    }
-    if (z_j && z_k) {
-      g += 4; g %= 8;
-    }
+  impl(const binary_circuit& c, int seed = 0, storage s = storage::automatic)
+    : impl(c.n(), seed, choose_storage(s, c.n(), c.ops()))
+  {
+    run(c.ops(), [](int) {});
   }
 
-  int toss_coin(std::optional<int> coin) {
-    deterministic = false;
-    if (coin) {
-      return *coin;
-    } else {
-      return rbg.get();
-    }
+  // Qubits are added as they are first used, since the stream cannot be read
+  // twice.
+  impl(std::istream& in, int seed = 0, storage s = storage::automatic)
+    : impl(1, seed, choose_storage(s))
+  {
+    stim_reader r(in);
+    run(r, [](int) {});
   }
 
-  int SimulateMeasX(unsigned j, std::optional<int> coin = std::nullopt) {
-    int beta;
-    std::optional<unsigned> c = principate(j);
-    if (c && Q.rowcol_is_zero(*c)) {
-      if (R0[*c] == 0) {
-        return R1[*c];
-      } else {
-        beta = toss_coin(coin);
-        R0[*c] = 0;
-        R1[*c] = beta;
-        return beta;
-      }
-    } else {
-      beta = toss_coin(coin);
-    }
-    const std::set<unsigned> H = A.cols_where_one(j);
-    for (unsigned h : H) {
-      R1[h] ^= beta;
-    }
-    new_principal_column(j, 0, beta, c);
-    return beta;
+  impl(std::pair<unsigned, storage> ns, const char *p, int seed)
+    : impl(ns.first, seed, ns.second)
+  {
+    stim_reader in(p);
+    run(in, [](int) {});
   }
 
-  int SimulateMeasY(unsigned j, std::optional<int> coin = std::nullopt) {
-    int beta;
-    std::optional<unsigned> c = principate(j);
-    if (c && Q.rowcol_is_zero(*c)) {
-      if (R0[*c] == 1) {
-        return R1[*c] ^ b[j];
-      } else {
-        beta = toss_coin(coin);
-        R0[*c] = 1;
-        R1[*c] = beta;
-        return beta;
-      }
-    } else {
-      beta = toss_coin(coin);
-    }
-    const std::set<unsigned> H = A.cols_where_one(j);
-    Q.flip_submatrix(H);
-    const int z = b[j] ^ beta;
-    for (unsigned h : H) {
-      R0[h] ^= 1;
-      R1[h] ^= R0[h] ^ z;
+  // Run the circuit at a path: "-", a pipe or anything else that is not a
+  // regular file can only be read once, and is streamed
+  static std::shared_ptr<impl> open(const char *p, int seed, storage s) {
+    if (std::string_view(p) == "-") {
+      return std::make_shared<impl>(std::cin, seed, s);
     }
-    new_principal_column(j, 1, beta, c);
-    return beta;
-  }
-
-  int SimulateMeasZ(unsigned j, std::optional<int> coin = std::nullopt) {
-    if (A.row_weight(j) == 0) {
-      return b[j];
-    } else {
-      int beta = toss_coin(coin);
-      const std::set<unsigned> H = A.cols_where_one(j);
-      unsigned k;
-      unsigned m = n + 1;
-      for (unsigned h : H) {
-        unsigned c = A.col_weight(h);
-        if (c < m) {
-          k = h;
-          m = c;
-        }
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(p, ec)) {
+      std::ifstream in(p);
+      if (!in) {
+        throw std::runtime_error("Cannot open file: " + std::string(p));
       }
-      ReindexSwapColumn(k);
-      MakePrincipal(r - 1, j);
-      FixFinalBit(beta ^ b[j]);
-      return beta;
+      return std::make_shared<impl>(in, seed, s);
     }
-  }
-
-  void SimulateResetX(unsigned j) {
-    if (SimulateMeasX(j, 0)) {
-      SimulateZ(j);
-    }
-  }
-
-  void SimulateResetY(unsigned j) {
-    if (SimulateMeasY(j, 0)) {
-      SimulateX(j);
-    }
-  }
-
-  void SimulateResetZ(unsigned j) {
-    if (SimulateMeasZ(j, 0)) {
-      SimulateX(j);
+    if (is_binary_circuit(p)) {
+      return std::make_shared<impl>(binary_circuit(p), seed, s);
     }
+    return std::make_shared<impl>(p, seed, s);
   }
 
   int phase() const { return g; }
-
-  bool is_deterministic() const { return deterministic; }
 };
 
 /* Public interface */
 
-Simplex::Simplex(unsigned n, int seed)
-  : pImpl(std::make_unique<impl>(n, seed)) {}
+Simplex::Simplex(unsigned n, int seed, storage s)
+  : pImpl(std::make_shared<impl>(n, seed, choose_storage(s))) {}
+
+Simplex::Simplex(const char *p, int seed, storage s)
+  : pImpl(impl::open(p, seed, s)) {}
 
-Simplex::Simplex(const char *p, int seed)
-  : pImpl(std::make_unique<impl>(p, seed)) {}
+Simplex::Simplex(std::istream& in, int seed, storage s)
+  : pImpl(std::make_shared<impl>(in, seed, s)) {}
+
+Simplex::Simplex(const struct instrs& is, int seed, storage s)
+  : pImpl(std::make_shared<impl>(is, seed, s)) {}
 
 Simplex::~Simplex() = default;
-Simplex::Simplex(const Simplex& other)
-  : pImpl(std::make_unique<impl>(*other.pImpl)) {}
+Simplex::Simplex(const Simplex& other) = default;
 Simplex::Simplex(Simplex&& other) = default;
-Simplex& Simplex::operator=(const Simplex& other) {
-  return *this = Simplex(other);
-}
+Simplex& Simplex::operator=(const Simplex& other) = default;
 Simplex& Simplex::operator=(Simplex&& other) = default;
 
 unsigned Simplex::n() const { return pImpl->n; }
-void Simplex::X(unsigned j) { pImpl->SimulateX(j); }
-void Simplex::Y(unsigned j) { pImpl->SimulateY(j); }
-void Simplex::Z(unsigned j) { pImpl->SimulateZ(j); }
-void Simplex::H(unsigned j) { pImpl->SimulateH(j); }
-void Simplex::S(unsigned j) { pImpl->SimulateS(j); }
-void Simplex::Sdg(unsigned j) { pImpl->SimulateSdg(j); }
-void Simplex::CX(unsigned j, unsigned k) { pImpl->SimulateCX(j, k); }
-void Simplex::CZ(unsigned j, unsigned k) { pImpl->SimulateCZ(j, k); }
+void Simplex::X(unsigned j) { unshare(pImpl).SimulateX(j); }
+void Simplex::Y(unsigned j) { unshare(pImpl).SimulateY(j); }
+void Simplex::Z(unsigned j) { unshare(pImpl).SimulateZ(j); }
+void Simplex::H(unsigned j) { unshare(pImpl).SimulateH(j); }
+void Simplex::S(unsigned j) { unshare(pImpl).SimulateS(j); }
+void Simplex::Sdg(unsigned j) { unshare(pImpl).SimulateSdg(j); }
+void Simplex::CX(unsigned j, unsigned k) { unshare(pImpl).SimulateCX(j, k); }
+void Simplex::CZ(unsigned j, unsigned k) { unshare(pImpl).SimulateCZ(j, k); }
 int Simplex::MeasX(unsigned j, std::optional<int> coin) {
-  return pImpl->SimulateMeasX(j, coin);
+  return unshare(pImpl).SimulateMeasX(j, coin);
 }
 int Simplex::MeasY(unsigned j, std::optional<int> coin) {
-  return pImpl->SimulateMeasY(j, coin);
+  return unshare(pImpl).SimulateMeasY(j, coin);
 }
 int Simplex::MeasZ(unsigned j, std::optional<int> coin) {
-  return pImpl->SimulateMeasZ(j, coin);
+  return unshare(pImpl).SimulateMeasZ(j, coin);
 }
-void Simplex::ResetX(unsigned j) { pImpl->SimulateResetX(j); }
-void Simplex::ResetY(unsigned j) { pImpl->SimulateResetY(j); }
-void Simplex::ResetZ(unsigned j) { pImpl->SimulateResetZ(j); }
+void Simplex::ResetX(unsigned j) { unshare(pImpl).SimulateResetX(j); }
+void Simplex::ResetY(unsigned j) { unshare(pImpl).SimulateResetY(j); }
+void Simplex::ResetZ(unsigned j) { unshare(pImpl).SimulateResetZ(j); }
 int Simplex::phase() const { return pImpl->phase(); }
 bool Simplex::is_deterministic() const { return pImpl->is_deterministic(); }
 
+shot_results Simplex::sample_all_z(unsigned n_shots, int seed) const {
+  const impl& I = *pImpl;
+  shot_results res;
+  res.n_shots = n_shots;
+  res.n_meas = I.n;
+  res.stride = words_for(I.n);
+  res.data.assign(std::size_t(n_shots) * res.stride, 0);
+  // The nonzero columns of each row of A:
+  std::vector<unsigned> offset{0}, cols, row;
+  for (unsigned j = 0; j < I.n; j++) {
+    I.A.cols_where_one(j, row);
+    cols.insert(cols.end(), row.begin(), row.end());
+    offset.push_back(cols.size());
+  }
+  // Shots are taken 64 at a time, one per bit of a word: each entry of x is a
+  // random word, and each result the XOR of b_j and the words in its row.
+  std::mt19937_64 gen(seed);
+  std::vector<uint64_t> x(I.n + 1);
+  for (std::size_t i0 = 0; i0 < n_shots; i0 += word_bits) {
+    for (unsigned l = 0; l < I.r; l++) {
+      x[I.perm[l]] = gen();
+    }
+    const unsigned n_batch = std::min<std::size_t>(word_bits, n_shots - i0);
+    const uint64_t live = (n_batch == word_bits)
+      ? ~uint64_t(0) : (uint64_t(1) << n_batch) - 1;
+    uint64_t* rows = res.data.data() + i0 * res.stride;
+    for (unsigned j = 0; j < I.n; j++) {
+      uint64_t z = I.b[j] ? ~uint64_t(0) : 0;
+      for (unsigned i = offset[j]; i < offset[j+1]; i++) {
+        z ^= x[cols[i]];
+      }
+      z &= live;
+      for_each_set_bit(&z, 1, [&](unsigned i) {
+        set_bit(rows + i * res.stride, j);
+      });
+    }
+  }
+  return res;
+}
+
+shot_results Simplex::sample_all(
+  std::string_view bases, unsigned n_shots, int seed) const
+{
+  if (bases.size() != n()) {
+    throw std::invalid_argument("Wrong number of bases");
+  }
+  Simplex T(*this);
+  for (unsigned j = 0; j < n(); j++) {
+    switch (bases[j]) {
+      case 'X':
+        T.H(j);
+        break;
+      case 'Y':
+        T.Sdg(j);
+        T.H(j);
+        break;
+      case 'Z':
+        break;
+      default:
+        throw std::invalid_argument(
+          "Unrecognized basis: " + std::string(1, bases[j]));
+    }
+  }
+  return T.sample_all_z(n_shots, seed);
+}
+
+struct SimplexBatch::impl : engine<lane_values> {
+  using engine::engine;
+};
+
+SimplexBatch::SimplexBatch(unsigned n, int seed, storage s)
+  : pImpl(std::make_shared<impl>(n, seed, choose_storage(s))) {}
+
+SimplexBatch::~SimplexBatch() = default;
+SimplexBatch::SimplexBatch(const SimplexBatch& other) = default;
+SimplexBatch::SimplexBatch(SimplexBatch&& other) = default;
+SimplexBatch& SimplexBatch::operator=(const SimplexBatch& other) = default;
+SimplexBatch& SimplexBatch::operator=(SimplexBatch&& other) = default;
+
+unsigned SimplexBatch::n() const { return pImpl->n; }
+void SimplexBatch::X(unsigned j) { unshare(pImpl).SimulateX(j); }
+void SimplexBatch::Y(unsigned j) { unshare(pImpl).SimulateY(j); }
+void SimplexBatch::Z(unsigned j) { unshare(pImpl).SimulateZ(j); }
+void SimplexBatch::H(unsigned j) { unshare(pImpl).SimulateH(j); }
+void SimplexBatch::S(unsigned j) { unshare(pImpl).SimulateS(j); }
+void SimplexBatch::Sdg(unsigned j) { unshare(pImpl).SimulateSdg(j); }
+void SimplexBatch::CX(unsigned j, unsigned k) {
+  unshare(pImpl).SimulateCX(j, k);
+}
+void SimplexBatch::CZ(unsigned j, unsigned k) {
+  unshare(pImpl).SimulateCZ(j, k);
+}
+uint64_t SimplexBatch::MeasX(unsigned j) {
+  return unshare(pImpl).SimulateMeasX(j);
+}
+uint64_t SimplexBatch::MeasY(unsigned j) {
+  return unshare(pImpl).SimulateMeasY(j);
+}
+uint64_t SimplexBatch::MeasZ(unsigned j) {
+  return unshare(pImpl).SimulateMeasZ(j);
+}
+void SimplexBatch::ResetX(unsigned j) { unshare(pImpl).SimulateResetX(j); }
+void SimplexBatch::ResetY(unsigned j) { unshare(pImpl).SimulateResetY(j); }
+void SimplexBatch::ResetZ(unsigned j) { unshare(pImpl).SimulateResetZ(j); }
+int SimplexBatch::phase(unsigned i) const {
+  int g = 0;
+  for (int l = 0; l < 3; l++) {
+    g |= ((pImpl->g.w[l] >> i) & 1) << l;
+  }
+  return g;
+}
+bool SimplexBatch::is_deterministic() const {
+  return pImpl->is_deterministic();
+}
+
+// Seed for batch i: the base seed and index mixed by the SplitMix64
+// finalizer, so that neighbouring batches get unrelated PRNG streams
+static int batch_seed(int seed, std::size_t i) {
+  uint64_t z = uint64_t(uint32_t(seed)) + (i + 1) * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return int(uint32_t(z ^ (z >> 31)));
+}
+
+shot_results Simplex::sample(
+  const struct instrs& is, unsigned n_shots, int seed, unsigned n_threads,
+  storage s)
+{
+  shot_results res;
+  res.n_shots = n_shots;
+  // Loops can take the count past what fits in n_meas:
+  constexpr uint64_t max_meas = std::numeric_limits<unsigned>::max();
+  uint64_t n_meas = 0;
+  for_each_op(is.ops, [&](const op& o, uint64_t times) {
+    if (o.type == optype::MeasX || o.type == optype::MeasY ||
+        o.type == optype::MeasZ) {
+      n_meas = (times > max_meas - n_meas) ? max_meas + 1 : n_meas + times;
+    }
+  });
+  if (n_meas > max_meas) {
+    throw std::overflow_error("Too many measurements to sample");
+  }
+  res.n_meas = n_meas;
+  res.stride = words_for(res.n_meas);
+  res.data.assign(std::size_t(n_shots) * res.stride, 0);
+
+  const storage st = choose_storage(s, is);
+  const std::size_t n_batches = words_for(n_shots);
+  if (n_threads == 0) {
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  n_threads = std::min<std::size_t>(
+    n_threads, std::max<std::size_t>(n_batches, 1));
+
+  // Batches are independent, so workers simply take them from a shared
+  // counter until none are left. Each batch writes only its own rows.
+  std::atomic<std::size_t> next_batch(0);
+  auto worker = [&]() {
+    for (;;) {
+      const std::size_t c = next_batch.fetch_add(1, std::memory_order_relaxed);
+      if (c >= n_batches) break;
+      const std::size_t i0 = c * word_bits;
+      const unsigned n_live = std::min<std::size_t>(word_bits, n_shots - i0);
+      const uint64_t live = (n_live == word_bits)
+        ? ~uint64_t(0) : (uint64_t(1) << n_live) - 1;
+      uint64_t* rows = res.data.data() + i0 * res.stride;
+      engine<lane_values> E(is.n, batch_seed(seed, c), st);
+      unsigned k = 0;
+      E.run(is, [&](uint64_t beta) {
+        beta &= live;
+        for_each_set_bit(&beta, 1, [&](unsigned i) {
+          set_bit(rows + i * res.stride, k);
+        });
+        k++;
+      });
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(n_threads - 1);
+  for (unsigned t = 1; t < n_threads; t++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& t : threads) {
+    t.join();
+  }
+  return res;
+}
+
 std::ostream& operator<<(std::ostream& os, const Simplex& S) {
   os << "n: " << S.n() << std::endl;
-  os << "A:" << std::endl << S.pImpl->A;
+  const auto& perm = S.pImpl->perm;
+  const unsigned r = S.pImpl->r;
+  os << "A:" << std::endl;
+  for (unsigned j = 0; j < S.n(); j++) {
+    os << "[ ";
+    for (unsigned h = 0; h < r; h++) {
+      os << S.pImpl->A.entry(j, perm[h]) << " ";
+    }
+    os << "]" << std::endl;
+  }
   os << "b: [ ";
   for (unsigned j = 0; j < S.n(); j++) {
     os << S.pImpl->b[j] << " ";
   }
   os << "]" << std::endl;
   os << "Q:" << std::endl;
-  unsigned r = S.pImpl->Q.r();
   for (unsigned j = 0; j < r; j++) {
+    const unsigned h1 = perm[j];
     os << "[ ";
-    int R = S.pImpl->R0[j] + 2 * S.pImpl->R1[j];
+    int R = S.pImpl->R0[h1] + 2 * S.pImpl->R1[h1];
     for (unsigned k = 0; k < r; k++) {
-      os << ((j == k) ? R : S.pImpl->Q.entry(j, k)) << " ";
+      os << ((j == k) ? R : S.pImpl->Q.entry(h1, perm[k])) << " ";
     }
     os << "]" << std::endl;
   }
   os << "g: " << S.pImpl->g << std::endl;
-  os << "p: " << S.pImpl->p << std::endl;
+  os << "p: ";
+  for (unsigned h = 0; h < r; h++) {
+    if (auto j = S.pImpl->p.fwd_at(perm[h])) {
+      os << h << ":" << *j << " ";
+    }
+  }
+  os << std::endl;
   return os;
 }
+
+/* Compiled sampling */
+
+Sampler::Sampler(const struct instrs& is, storage s)
+  : meas_count(0), coin_count(0), offset{0}
+{
+  engine<affine_values> E(is.n, 0, choose_storage(s, is));
+  E.run(is, [&](const affine& f) {
+    constant.resize(words_for(meas_count + 1));
+    if (f.c) set_bit(constant.data(), meas_count);
+    vars.insert(vars.end(), f.vars.begin(), f.vars.end());
+    offset.push_back(vars.size());
+    meas_count++;
+  });
+  coin_count = E.vals.n_vars;
+}
+
+Sampler::Sampler(const char *p, storage s) : Sampler(parse_file(p), s) {}
+
+void Sampler::evaluate(const uint64_t *coins, uint64_t *results) const {
+  std::fill(results, results + words_for(meas_count), 0);
+  for (unsigned k = 0; k < meas_count; k++) {
+    int x = get_bit(constant.data(), k);
+    for (unsigned i = offset[k]; i < offset[k+1]; i++) {
+      x ^= get_bit(coins, vars[i]);
+    }
+    if (x) set_bit(results, k);
+  }
+}
+
+shot_results Sampler::sample(unsigned n_shots, int seed) const {
+  shot_results res;
+  res.n_shots = n_shots;
+  res.n_meas = meas_count;
+  res.stride = words_for(meas_count);
+  res.data.assign(std::size_t(n_shots) * res.stride, 0);
+  // Shots are taken 64 at a time, one per bit of a word: each coin is a
+  // random word, and each measurement result the XOR of its coins' words.
+  std::mt19937_64 gen(seed);
+  std::vector<uint64_t> coin_words(coin_count);
+  for (std::size_t i0 = 0; i0 < n_shots; i0 += word_bits) {
+    for (uint64_t& w : coin_words) {
+      w = gen();
+    }
+    const unsigned n_batch = std::min<std::size_t>(word_bits, n_shots - i0);
+    const uint64_t live = (n_batch == word_bits)
+      ? ~uint64_t(0) : (uint64_t(1) << n_batch) - 1;
+    uint64_t* rows = res.data.data() + i0 * res.stride;
+    for (unsigned k = 0; k < meas_count; k++) {
+      uint64_t x = get_bit(constant.data(), k) ? ~uint64_t(0) : 0;
+      for (unsigned i = offset[k]; i < offset[k+1]; i++) {
+        x ^= coin_words[vars[i]];
+      }
+      x &= live;
+      for_each_set_bit(&x, 1, [&](unsigned i) {
+        set_bit(rows + i * res.stride, k);
+      });
+    }
+  }
+  return res;
+}
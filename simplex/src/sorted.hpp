@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+/* Helpers for sets stored as strictly increasing vectors */
+
+template <typename T>
+bool sorted_contains(const std::vector<T>& v, T x) {
+  return std::binary_search(v.begin(), v.end(), x);
+}
+
+// Insert x if absent, otherwise remove it
+template <typename T>
+void sorted_toggle(std::vector<T>& v, T x) {
+  auto it = std::lower_bound(v.begin(), v.end(), x);
+  if (it != v.end() && *it == x) {
+    v.erase(it);
+  } else {
+    v.insert(it, x);
+  }
+}
+
+template <typename T>
+void sorted_erase(std::vector<T>& v, T x) {
+  auto it = std::lower_bound(v.begin(), v.end(), x);
+  if (it != v.end() && *it == x) {
+    v.erase(it);
+  }
+}
+
+template <typename T>
+void sorted_insert(std::vector<T>& v, T x) {
+  auto it = std::lower_bound(v.begin(), v.end(), x);
+  if (it == v.end() || *it != x) {
+    v.insert(it, x);
+  }
+}
+
+// Replace v with the symmetric difference of v and the sorted range w, using
+// out as scratch
+template <typename T, typename R>
+void sorted_xor(std::vector<T>& v, const R& w, std::vector<T>& out) {
+  out.clear();
+  std::set_symmetric_difference(
+    v.begin(), v.end(), w.begin(), w.end(), std::back_inserter(out));
+  v.swap(out);
+}
+
+// Write the intersection of a and b to out, galloping through the longer one
+template <typename T>
+void sorted_intersect(
+  const std::vector<T>& a, const std::vector<T>& b, std::vector<T>& out)
+{
+  out.clear();
+  const std::vector<T>& s = (a.size() <= b.size()) ? a : b;
+  const std::vector<T>& l = (a.size() <= b.size()) ? b : a;
+  auto it = l.begin();
+  const auto end = l.end();
+  for (T x : s) {
+    // Find a range [lo, hi) containing the first element >= x:
+    auto lo = it;
+    auto hi = it;
+    std::ptrdiff_t step = 1;
+    while (hi != end && *hi < x) {
+      lo = hi;
+      hi = (end - hi > step) ? hi + step : end;
+      step *= 2;
+    }
+    it = std::lower_bound(lo, hi, x);
+    if (it == end) break;
+    if (*it == x) {
+      out.push_back(x);
+    }
+  }
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include "bits.hpp"
+#include "sorted.hpp"
+
+#include <random>
+#include <span>
+#include <vector>
+
+/*
+ * Values of the coin-dependent part of the state.
+ *
+ * The matrices A and Q, the vector R0 and the principal map evolve in the same
+ * way whatever the outcomes of the coin tosses: only b, R1 and the phase g
+ * depend on them, and only affinely. The simulation engine is parametrized by
+ * a policy saying what an entry of b or R1 is. A policy provides:
+ *
+ * - `value`, the type of an entry, with `^` and `value{}` as zero;
+ * - `vector`, the type of b and R1, made by `make_vector(size)` and enlarged
+ *   (with zeros) by `resize(v, size)`;
+ * - `phase`, the type of g;
+ * - `one()`, `constant(x)` and `coin()` to make values;
+ * - the operations on vectors and phases used by the engine.
+ */
+
+class RBG {
+public:
+  RBG(int seed = 0) : gen(seed), distrib(0, 1) {}
+  int get() { return distrib(gen); }
+private:
+  std::mt19937 gen;
+  std::uniform_int_distribution<> distrib;
+};
+
+/**
+ * Entries are bits, for simulating a single shot.
+ */
+struct bit_values {
+  using value = int;
+  using vector = bitvec;
+  using phase = int;
+
+  bit_values(int seed) : rbg(seed) {}
+
+  static value one() { return 1; }
+  static value constant(int x) { return x; }
+  value coin() { return rbg.get(); }
+
+  static vector make_vector(unsigned size) { return bitvec(size); }
+  static void resize(vector& v, unsigned size) { v.resize(size); }
+
+  static value get(const vector& v, unsigned i) { return v[i]; }
+  static void set(vector& v, unsigned i, value x) { v.set(i, x); }
+
+  static void xor_at(vector& v, unsigned i, value x) {
+    if (x) v.flip(i);
+  }
+
+  static void xor_over(vector& v, std::span<const unsigned> H, value x) {
+    if (x) v.flip(H);
+  }
+
+  // For each h in H, XOR R0[h] ^ z into R1[h] and then flip R0[h]
+  static void twist(
+    bitvec& R0, vector& R1, std::span<const unsigned> H, value z)
+  {
+    const uint64_t zm = z ? ~uint64_t(0) : 0;
+    for_each_word_mask(H, [&](std::size_t k, uint64_t m) {
+      R1.word(k) ^= (R0.word(k) ^ zm) & m;
+      R0.word(k) ^= m;
+    });
+  }
+
+  // For each k in H, XOR R1c ^ Q_c[k] ^ (R0[k] & R0c) into R1[k] and then
+  // R0c into R0[k]
+  static void subtract(
+    bitvec& R0, vector& R1, bitvec& Q_c, std::span<const unsigned> H,
+    int R0c, value R1c)
+  {
+    const uint64_t r0m = R0c ? ~uint64_t(0) : 0;
+    const uint64_t r1m = R1c ? ~uint64_t(0) : 0;
+    for_each_word_mask(H, [&](std::size_t k, uint64_t m) {
+      R1.word(k) ^= (r1m ^ Q_c.word(k) ^ (R0.word(k) & r0m)) & m;
+      R0.word(k) ^= r0m & m;
+    });
+  }
+
+  static void add_phase(phase& g, int k) { g = (g + k) % 8; }
+
+  static void add_phase(phase& g, int k, value x) {
+    if (x) add_phase(g, k);
+  }
+
+  static void add_phase(phase& g, int k, value x, value y) {
+    if (x && y) add_phase(g, k);
+  }
+
+  RBG rbg;
+};
+
+/**
+ * An affine function over GF(2) of coin variables x_0, x_1, ...: the sum of
+ * the constant c and the variables whose indices are in vars (increasing).
+ */
+struct affine {
+  int c = 0;
+  std::vector<unsigned> vars;
+
+  affine& operator^=(const affine& other) {
+    c ^= other.c;
+    if (!other.vars.empty()) {
+      std::vector<unsigned> tmp;
+      sorted_xor(vars, other.vars, tmp);
+    }
+    return *this;
+  }
+
+  friend affine operator^(affine a, const affine& b) { return a ^= b; }
+};
+
+/**
+ * Operations on vectors of values of type T, with one() given by Derived.
+ */
+template <typename T, typename Derived>
+struct vector_values {
+  using value = T;
+  using vector = std::vector<T>;
+
+  static vector make_vector(unsigned size) { return vector(size); }
+  static void resize(vector& v, unsigned size) { v.resize(size); }
+
+  static const value& get(const vector& v, unsigned i) { return v[i]; }
+  static void set(vector& v, unsigned i, value x) { v[i] = std::move(x); }
+  static void xor_at(vector& v, unsigned i, const value& x) { v[i] ^= x; }
+
+  static void xor_over(
+    vector& v, std::span<const unsigned> H, const value& x)
+  {
+    for (unsigned h : H) {
+      v[h] ^= x;
+    }
+  }
+
+  static void twist(
+    bitvec& R0, vector& R1, std::span<const unsigned> H, const value& z)
+  {
+    for (unsigned h : H) {
+      R1[h] ^= z;
+      if (R0[h]) R1[h] ^= Derived::one();
+      R0.flip(h);
+    }
+  }
+
+  static void subtract(
+    bitvec& R0, vector& R1, const bitvec& Q_c, std::span<const unsigned> H,
+    int R0c, const value& R1c)
+  {
+    for (unsigned k : H) {
+      R1[k] ^= R1c;
+      if (Q_c[k] ^ (R0[k] & R0c)) R1[k] ^= Derived::one();
+      if (R0c) R0.flip(k);
+    }
+  }
+};
+
+/**
+ * Entries are affine functions of the coin tosses, for compiling a circuit:
+ * each coin tossed is a new variable. The phase is not tracked, since it is
+ * not an affine function of the coins.
+ */
+struct affine_values : vector_values<affine, affine_values> {
+  struct phase {};
+
+  affine_values(int) {}
+
+  static value one() { return {1, {}}; }
+  static value constant(int x) { return {x, {}}; }
+  value coin() { return {0, {n_vars++}}; }
+
+  static void add_phase(phase&, int) {}
+  static void add_phase(phase&, int, const value&) {}
+  static void add_phase(phase&, int, const value&, const value&) {}
+
+  unsigned n_vars = 0; // number of coins tossed so far
+};
+
+/**
+ * Entries are words holding one bit for each of 64 shots, for simulating the
+ * shots together. Each coin is a random word. The phase of each shot is kept
+ * as three bit-planes.
+ */
+struct lane_values : vector_values<uint64_t, lane_values> {
+  struct phase { uint64_t w[3]; };
+
+  lane_values(int seed) : gen(seed) {}
+
+  static value one() { return ~uint64_t(0); }
+  static value constant(int x) { return x ? one() : 0; }
+  value coin() { return gen(); }
+
+  // Add k (mod 8) to the phases of the shots where x is 1
+  static void add_phase(phase& g, int k, value x) {
+    const uint64_t a0 = (k & 1) ? x : 0;
+    const uint64_t a1 = (k & 2) ? x : 0;
+    const uint64_t a2 = (k & 4) ? x : 0;
+    const uint64_t c0 = g.w[0] & a0;
+    const uint64_t c1 = (g.w[1] & a1) | ((g.w[1] ^ a1) & c0);
+    g.w[0] ^= a0;
+    g.w[1] ^= a1 ^ c0;
+    g.w[2] ^= a2 ^ c1;
+  }
+
+  static void add_phase(phase& g, int k) { add_phase(g, k, one()); }
+
+  static void add_phase(phase& g, int k, value x, value y) {
+    add_phase(g, k, x & y);
+  }
+
+  std::mt19937_64 gen;
+};
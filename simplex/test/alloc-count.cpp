@@ -0,0 +1,42 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Replacement of the global allocation functions, counting allocations. It
+// is kept out of simplex-test.cpp so that the compiler does not see malloc
+// and free through inlined new and delete expressions.
+
+std::atomic<std::size_t> n_allocs(0);
+
+void* operator new(std::size_t size) {
+  n_allocs++;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { ::operator delete(p); }
+
+// Over-aligned allocations (as made by aligned_allocator) take a block from
+// malloc with room to align within it, and keep the start of the block just
+// before the pointer returned, since std::aligned_alloc is not portable.
+
+void* operator new(std::size_t size, std::align_val_t align) {
+  n_allocs++;
+  const std::size_t a = std::size_t(align);
+  void* q = std::malloc(size + a + sizeof(void*));
+  if (!q) throw std::bad_alloc();
+  const std::uintptr_t u = reinterpret_cast<std::uintptr_t>(q) + sizeof(void*);
+  void* p = reinterpret_cast<void*>((u + a - 1) / a * a);
+  static_cast<void**>(p)[-1] = q;
+  return p;
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+  if (p) std::free(static_cast<void**>(p)[-1]);
+}
+void operator delete(void* p, std::size_t, std::align_val_t align) noexcept {
+  ::operator delete(p, align);
+}
@@ -0,0 +1,13 @@
+#include <binary-circuit.hpp>
+#include <parse-stim.hpp>
+#include <iostream>
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " STIM_FILE OUT_FILE" << std::endl;
+    std::cerr << "(writes OUT_FILE in the binary circuit format)" << std::endl;
+    return 1;
+  }
+  write_binary_circuit(parse_file(argv[1]), argv[2]);
+  return 0;
+}
@@ -5,7 +5,9 @@
 
 int main(int argc, char *argv[]) {
   if (argc < 2 || argc > 3) {
-    std::cerr << "Usage: " << argv[0] << "FILE [SEED]" << std::endl;
+    std::cerr << "Usage: " << argv[0] << " FILE [SEED]" << std::endl;
+    std::cerr << "(FILE may be - to read from standard input)" << std::endl;
+    return 1;
   }
   int seed = 0;
   if (argc == 3) {
@@ -0,0 +1,30 @@
+#include <parse-stim.hpp>
+#include <simplex.hpp>
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 5) {
+    std::cerr << "Usage: " << argv[0] << " FILE SHOTS [SEED [THREADS]]"
+      << std::endl;
+    return 1;
+  }
+  unsigned n_shots = atol(argv[2]);
+  int seed = 0;
+  if (argc >= 4) {
+    seed = atol(argv[3]);
+  }
+  unsigned n_threads = 0;
+  if (argc == 5) {
+    n_threads = atol(argv[4]);
+  }
+  shot_results res = Simplex::sample(parse_file(argv[1]), n_shots, seed,
+    n_threads);
+  for (unsigned i = 0; i < res.n_shots; i++) {
+    for (unsigned k = 0; k < res.n_meas; k++) {
+      std::cout << res.get(i, k);
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
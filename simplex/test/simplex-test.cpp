@@ -1,7 +1,22 @@
+#include <binary-circuit.hpp>
+#include <parse-stim.hpp>
 #include <simplex.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
 #define CHECK(a) \
   do { \
     if (!(a)) { \
@@ -12,6 +27,10 @@
 
 #define CHECK_OK(a) CHECK(!(a))
 
+// Number of heap allocations so far (for test_no_allocation), counted by the
+// replacement operator new in alloc-count.cpp
+extern std::atomic<std::size_t> n_allocs;
+
 static int test_X() {
   Simplex S(2);
   S.X(0);
@@ -2233,6 +2252,624 @@ static int test_reset() {
   return 0;
 }
 
+// Stim names of the optypes
+static const char* names[] = {
+  "X", "Y", "Z", "H", "S", "S_DAG", "CX", "CZ", "MX", "MY", "M", "RX", "RY",
+  "R"};
+
+// A random circuit of count gates, measurements and resets on n qubits
+static std::vector<op> random_ops(unsigned n, unsigned count, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::vector<op> ops;
+  for (unsigned i = 0; i < count; i++) {
+    optype t = optype(gen() % 14);
+    unsigned j = gen() % n, k = gen() % (n - 1);
+    if (k >= j) k++;
+    if (t == optype::CX || t == optype::CZ) {
+      ops.push_back({t, {j, k}});
+    } else {
+      ops.push_back({t, {j}});
+    }
+  }
+  return ops;
+}
+
+// Write ops as Stim text
+static std::string stim_text(const std::vector<op>& ops) {
+  std::ostringstream text;
+  for (const op& o : ops) {
+    text << names[o.type] << " " << o.qubits[0];
+    if (o.type == optype::CX || o.type == optype::CZ) {
+      text << " " << o.qubits[1];
+    }
+    text << "\n";
+  }
+  return text.str();
+}
+
+// Whether an op is a measurement
+static bool is_meas(const op& o) {
+  return o.type == optype::MeasX || o.type == optype::MeasY ||
+    o.type == optype::MeasZ;
+}
+
+// Apply an op to a state, returning the outcome of a measurement (with the
+// given coin) or -1
+static int apply(Simplex& S, const op& o, std::optional<int> coin = {}) {
+  const unsigned j = o.qubits[0];
+  switch (o.type) {
+    case optype::X: S.X(j); break;
+    case optype::Y: S.Y(j); break;
+    case optype::Z: S.Z(j); break;
+    case optype::H: S.H(j); break;
+    case optype::S: S.S(j); break;
+    case optype::Sdg: S.Sdg(j); break;
+    case optype::CX: S.CX(j, o.qubits[1]); break;
+    case optype::CZ: S.CZ(j, o.qubits[1]); break;
+    case optype::MeasX: return S.MeasX(j, coin);
+    case optype::MeasY: return S.MeasY(j, coin);
+    case optype::MeasZ: return S.MeasZ(j, coin);
+    case optype::ResetX: S.ResetX(j); break;
+    case optype::ResetY: S.ResetY(j); break;
+    case optype::ResetZ: S.ResetZ(j); break;
+    case optype::Repeat: throw std::logic_error("Unexpected REPEAT");
+  }
+  return -1;
+}
+
+static int test_storage() {
+  // All storage schemes give the same results for the same coins.
+  const storage schemes[] = {
+    storage::sparse, storage::flat, storage::hybrid, storage::dense,
+    storage::packed};
+  std::vector<int> results[5];
+  for (unsigned i = 0; i < 5; i++) {
+    Simplex S(5, 0, schemes[i]);
+    for (int round = 0; round < 3; round++) {
+      S.H(0);
+      S.H(3);
+      S.CX(0, 1);
+      S.CZ(1, 2);
+      S.S(2);
+      S.CX(3, 4);
+      S.H(2);
+      S.CX(2, 0);
+      S.Sdg(4);
+      S.CZ(4, 0);
+      results[i].push_back(S.MeasX(1, round & 1));
+      results[i].push_back(S.MeasY(2, 1));
+      results[i].push_back(S.MeasZ(0, 0));
+      S.ResetZ(3);
+    }
+    for (unsigned j = 0; j < 5; j++) {
+      results[i].push_back(S.MeasZ(j, 1));
+    }
+    results[i].push_back(S.phase());
+  }
+  for (unsigned i = 1; i < 5; i++) {
+    CHECK(results[i] == results[0]);
+  }
+  // Enough qubits for packed rows to span several words, with an entangling
+  // stage that makes hybrid rows into bitmaps, followed by measurements and
+  // resets that thin them out into arrays again:
+  const unsigned n = 150;
+  std::vector<op> ops;
+  std::mt19937 gen(21);
+  for (unsigned j = 0; j < n; j++) {
+    ops.push_back({optype::H, {j}});
+  }
+  for (unsigned i = 0; i < 1500; i++) {
+    const optype t = (i % 3 == 0) ? optype::S : (i % 3 == 1) ? optype::CZ :
+      optype::CX;
+    unsigned j = gen() % n, k = gen() % (n - 1);
+    if (k >= j) k++;
+    ops.push_back({t, {j, k}});
+  }
+  const std::vector<op> tail = random_ops(n, 3000, 23);
+  ops.insert(ops.end(), tail.begin(), tail.end());
+  for (unsigned j = 0; j < n; j++) {
+    ops.push_back({optype::MeasZ, {j}});
+  }
+  for (unsigned i = 0; i < 5; i++) {
+    results[i].clear();
+    Simplex S(n, 0, schemes[i]);
+    unsigned k = 0;
+    for (const op& o : ops) {
+      const int m = apply(S, o, k++ % 3 == 0);
+      if (m >= 0) results[i].push_back(m);
+    }
+    results[i].push_back(S.phase());
+  }
+  for (unsigned i = 1; i < 5; i++) {
+    CHECK(results[i] == results[0]);
+  }
+  return 0;
+}
+
+static int test_no_allocation() {
+  // Once constructed, a simulator with dense or packed storage applies gates
+  // without using the heap (counting over-aligned allocations, which the
+  // packed backend uses for its rows). The sparse, flat and hybrid backends
+  // allocate as rows grow and change representation, but at most a couple
+  // of times per operation.
+  auto run = [](Simplex& S) {
+    unsigned n_ops = 0;
+    for (unsigned round = 0; round < 20; round++) {
+      for (unsigned j = 0; j < 8; j++) {
+        S.H(j);
+        S.CX(j, (j + 1) % 8);
+        S.S((j + 3) % 8);
+        S.CZ(j, (j + 5) % 8);
+        S.Sdg((j + 2) % 8);
+      }
+      S.MeasX(round % 8);
+      S.MeasY((round + 3) % 8);
+      S.MeasZ((round + 6) % 8);
+      S.ResetZ((round + 1) % 8);
+      S.Z(round % 8);
+      S.Y((round + 4) % 8);
+      n_ops += 8 * 5 + 6;
+    }
+    return n_ops;
+  };
+  for (storage s : {storage::dense, storage::packed}) {
+    Simplex S(8, 1, s);
+    const std::size_t n0 = n_allocs;
+    run(S);
+    CHECK(n_allocs == n0);
+  }
+  for (storage s : {storage::sparse, storage::flat, storage::hybrid}) {
+    Simplex S(8, 1, s);
+    const std::size_t n0 = n_allocs;
+    const unsigned n_ops = run(S);
+    CHECK(n_allocs - n0 <= 2 * n_ops);
+  }
+  return 0;
+}
+
+static int test_copy_on_write() {
+  // Operations on a copy do not affect the original, or vice versa. With
+  // enough qubits for the sparse backends' rows to span several shared
+  // blocks, the suffix writes to some of the blocks and not others.
+  const unsigned n = 200;
+  const std::vector<op> pre = random_ops(n, 600, 31);
+  const std::vector<op> post = random_ops(n, 40, 32);
+  auto prefix = [&](Simplex& S) {
+    unsigned k = 0;
+    for (const op& o : pre) {
+      apply(S, o, k++ % 2);
+    }
+  };
+  auto suffix = [&](Simplex& S, int coin) {
+    for (const op& o : post) {
+      apply(S, o, coin);
+    }
+  };
+  for (storage s : {
+      storage::sparse, storage::flat, storage::hybrid, storage::dense,
+      storage::packed}) {
+    Simplex S(n, 0, s);
+    prefix(S);
+    Simplex T(S);
+    Simplex U(T);
+    suffix(T, 1);
+    suffix(S, 0);
+    Simplex R0(n, 0, s), R1(n, 0, s);
+    prefix(R0);
+    prefix(R1);
+    suffix(R0, 0);
+    suffix(R1, 1);
+    for (unsigned j = 0; j < n; j++) {
+      CHECK(S.MeasZ(j, 0) == R0.MeasZ(j, 0));
+      CHECK(T.MeasZ(j, 0) == R1.MeasZ(j, 0));
+    }
+    CHECK(S.phase() == R0.phase());
+    CHECK(T.phase() == R1.phase());
+    // U still holds the state after the prefix:
+    Simplex V(n, 0, s);
+    prefix(V);
+    for (unsigned j = 0; j < n; j++) {
+      CHECK(U.MeasX(j, 1) == V.MeasX(j, 1));
+    }
+  }
+  return 0;
+}
+
+static int test_sample() {
+  instrs is{3, {
+    {optype::H, {0}},
+    {optype::CX, {0, 1}},
+    {optype::MeasZ, {0}},
+    {optype::MeasZ, {1}},
+    {optype::H, {2}},
+    {optype::MeasX, {2}},
+    {optype::ResetZ, {0}},
+    {optype::MeasZ, {0}},
+  }};
+  const unsigned n_shots = 100;
+  shot_results res = Simplex::sample(is, n_shots, 7, 1);
+  CHECK(res.n_shots == n_shots);
+  CHECK(res.n_meas == 4);
+  unsigned n_ones = 0;
+  for (unsigned i = 0; i < n_shots; i++) {
+    CHECK(res.get(i, 0) == res.get(i, 1));
+    CHECK(res.get(i, 2) == 0);
+    CHECK(res.get(i, 3) == 0);
+    n_ones += res.get(i, 0);
+  }
+  CHECK(n_ones > 0 && n_ones < n_shots);
+  // The results do not depend on the number of threads or the storage:
+  CHECK(Simplex::sample(is, n_shots, 7, 3).data == res.data);
+  CHECK(Simplex::sample(is, n_shots, 7, 2, storage::sparse).data == res.data);
+  // ... but do depend on the seed:
+  CHECK(Simplex::sample(is, n_shots, 8, 1).data != res.data);
+  // Too many measurements to count is an error:
+  const instrs big{1, {
+    {optype::Repeat, {1u << 16, 2}},
+    {optype::Repeat, {1u << 16, 1}},
+    {optype::MeasZ, {0}},
+  }};
+  bool rejected = false;
+  try {
+    Simplex::sample(big, 1, 0, 1);
+  } catch (const std::overflow_error&) {
+    rejected = true;
+  }
+  CHECK(rejected);
+  return 0;
+}
+
+static int test_sampler() {
+  // A random circuit:
+  const unsigned n = 6;
+  std::mt19937 gen(5);
+  instrs is{n, random_ops(n, 300, 5)};
+  Sampler C(is);
+  CHECK(C.n_coins() > 0);
+  std::vector<uint64_t> coins((C.n_coins() + 63) / 64);
+  std::vector<uint64_t> results((C.n_meas() + 63) / 64);
+  for (unsigned trial = 0; trial < 10; trial++) {
+    for (uint64_t& w : coins) {
+      w = uint64_t(gen()) << 32 | gen();
+    }
+    C.evaluate(coins.data(), results.data());
+    // Simulate with the same coins, telling random measurements apart by
+    // measuring copies of the state with different coins:
+    Simplex S(n);
+    unsigned k = 0, i = 0;
+    for (const op& o : is.ops) {
+      if (!is_meas(o)) {
+        apply(S, o);
+        continue;
+      }
+      Simplex T0(S), T1(S);
+      int coin = 0;
+      if (apply(T0, o, 0) != apply(T1, o, 1)) {
+        coin = (coins[i / 64] >> (i % 64)) & 1;
+        i++;
+      }
+      CHECK(apply(S, o, coin) == int((results[k / 64] >> (k % 64)) & 1));
+      k++;
+    }
+    CHECK(k == C.n_meas());
+    CHECK(i == C.n_coins());
+  }
+  // Sampled shots are the results for some coins:
+  instrs ghz{3, {
+    {optype::H, {0}},
+    {optype::CX, {0, 1}},
+    {optype::CX, {1, 2}},
+    {optype::MeasZ, {2}},
+    {optype::MeasZ, {0}},
+    {optype::MeasX, {1}},
+    {optype::MeasZ, {1}},
+  }};
+  Sampler G(ghz);
+  CHECK(G.n_meas() == 4);
+  CHECK(G.n_coins() == 3);
+  shot_results res = G.sample(100, 3);
+  CHECK(res.n_shots == 100);
+  unsigned n_ones = 0;
+  for (unsigned i = 0; i < 100; i++) {
+    CHECK(res.get(i, 0) == res.get(i, 1));
+    n_ones += res.get(i, 0);
+  }
+  CHECK(n_ones > 0 && n_ones < 100);
+  CHECK(G.sample(100, 3).data == res.data);
+  return 0;
+}
+
+static int test_batch() {
+  // A random circuit, simulated on a batch:
+  const unsigned n = 6;
+  const std::vector<op> ops = random_ops(n, 300, 9);
+  SimplexBatch B(n, 2);
+  std::vector<uint64_t> results;
+  for (const op& o : ops) {
+    const unsigned j = o.qubits[0];
+    switch (o.type) {
+      case optype::X: B.X(j); break;
+      case optype::Y: B.Y(j); break;
+      case optype::Z: B.Z(j); break;
+      case optype::H: B.H(j); break;
+      case optype::S: B.S(j); break;
+      case optype::Sdg: B.Sdg(j); break;
+      case optype::CX: B.CX(j, o.qubits[1]); break;
+      case optype::CZ: B.CZ(j, o.qubits[1]); break;
+      case optype::MeasX: results.push_back(B.MeasX(j)); break;
+      case optype::MeasY: results.push_back(B.MeasY(j)); break;
+      case optype::MeasZ: results.push_back(B.MeasZ(j)); break;
+      case optype::ResetX: B.ResetX(j); break;
+      case optype::ResetY: B.ResetY(j); break;
+      case optype::ResetZ: B.ResetZ(j); break;
+      case optype::Repeat: throw std::logic_error("Unexpected REPEAT");
+    }
+  }
+  CHECK(!B.is_deterministic());
+  // Each shot is a simulation where the random measurements give the
+  // results of that shot:
+  bool some_random = false;
+  for (unsigned i = 0; i < 64; i++) {
+    Simplex S(n);
+    unsigned k = 0;
+    for (const op& o : ops) {
+      if (!is_meas(o)) {
+        apply(S, o);
+        continue;
+      }
+      const int beta = (results[k] >> i) & 1;
+      Simplex T0(S), T1(S);
+      if (apply(T0, o, 0) == apply(T1, o, 1)) {
+        CHECK(apply(S, o) == beta);
+      } else {
+        some_random = true;
+        CHECK(apply(S, o, beta) == beta);
+      }
+      k++;
+    }
+    CHECK(S.phase() == B.phase(i));
+  }
+  CHECK(some_random);
+  return 0;
+}
+
+static int test_stream() {
+  // A random circuit on many qubits, so that a reader of the stream has to
+  // add them as it goes:
+  const unsigned n = 600;
+  instrs is{n, random_ops(n, 4000, 7)};
+  is.ops.push_back({optype::H, {n - 1}});
+  const std::string text = stim_text(is.ops);
+  for (storage s : {
+      storage::sparse, storage::flat, storage::hybrid, storage::dense,
+      storage::packed}) {
+    std::istringstream in(text);
+    Simplex S0(is, 3, s);
+    Simplex S1(in, 3, s);
+    CHECK(S1.n() == n);
+    CHECK(S1.phase() == S0.phase());
+    for (unsigned j = 0; j < n; j++) {
+      CHECK(S1.MeasZ(j, 0) == S0.MeasZ(j, 0));
+    }
+  }
+  return 0;
+}
+
+static int test_sample_all() {
+  // A random circuit without measurements:
+  const unsigned n = 8;
+  std::mt19937 gen(11);
+  Simplex S(n);
+  for (unsigned i = 0; i < 100; i++) {
+    unsigned j = gen() % n, k = gen() % (n - 1);
+    if (k >= j) k++;
+    switch (gen() % 4) {
+      case 0: S.H(j); break;
+      case 1: S.S(j); break;
+      case 2: S.CX(j, k); break;
+      case 3: S.X(j); break;
+    }
+  }
+  std::stringstream before;
+  before << S;
+  const char* bases[] = {"ZZZZZZZZ", "XXXXXXXX", "YYYYYYYY", "XYZZYXZY"};
+  for (const char* B : bases) {
+    shot_results res = S.sample_all(B, 100, 4);
+    CHECK(res.n_shots == 100);
+    CHECK(res.n_meas == n);
+    // Each shot is a possible result of measuring the qubits in turn:
+    for (unsigned i = 0; i < 100; i++) {
+      Simplex T(S);
+      for (unsigned j = 0; j < n; j++) {
+        const int beta = res.get(i, j);
+        switch (B[j]) {
+          case 'X': CHECK(T.MeasX(j, beta) == beta); break;
+          case 'Y': CHECK(T.MeasY(j, beta) == beta); break;
+          case 'Z': CHECK(T.MeasZ(j, beta) == beta); break;
+        }
+      }
+    }
+  }
+  // The state is unchanged:
+  std::stringstream after;
+  after << S;
+  CHECK(before.str() == after.str());
+  // GHZ state:
+  Simplex G(3);
+  G.H(0);
+  G.CX(0, 1);
+  G.CX(1, 2);
+  shot_results res = G.sample_all_z(200, 1);
+  unsigned n_ones = 0;
+  for (unsigned i = 0; i < 200; i++) {
+    CHECK(res.get(i, 0) == res.get(i, 1));
+    CHECK(res.get(i, 1) == res.get(i, 2));
+    n_ones += res.get(i, 0);
+  }
+  CHECK(n_ones > 0 && n_ones < 200);
+  // Bases of the wrong number or kind are rejected:
+  for (const char* B : {"ZZ", "ZZZZ", "ZQZ"}) {
+    bool rejected = false;
+    try {
+      G.sample_all(B, 10);
+    } catch (const std::invalid_argument&) {
+      rejected = true;
+    }
+    CHECK(rejected);
+  }
+  return 0;
+}
+
+static int test_binary_circuit() {
+  const unsigned n = 8;
+  instrs is{n, random_ops(n, 500, 11)};
+  const char* p = "simplex-test-circuit.bin";
+  write_binary_circuit(is, p);
+  CHECK(is_binary_circuit(p));
+  const instrs is1 = parse_file(p);
+  CHECK(is1.n == n);
+  CHECK(is1.ops.size() == is.ops.size());
+  for (unsigned i = 0; i < is.ops.size(); i++) {
+    CHECK(is1.ops[i].type == is.ops[i].type);
+    CHECK(is1.ops[i].qubits == is.ops[i].qubits);
+  }
+  Simplex S0(is, 2);
+  Simplex S1(p, 2);
+  CHECK(S1.n() == n);
+  CHECK(S1.phase() == S0.phase());
+  for (unsigned j = 0; j < n; j++) {
+    CHECK(S1.MeasZ(j, 0) == S0.MeasZ(j, 0));
+  }
+  // A file with an out-of-range qubit is rejected:
+  is.ops.push_back({optype::H, {n}});
+  write_binary_circuit(is, p);
+  bool rejected = false;
+  try {
+    binary_circuit c(p);
+  } catch (const std::runtime_error&) {
+    rejected = true;
+  }
+  CHECK(rejected);
+  std::remove(p);
+  return 0;
+}
+
+// Read all the instructions from a stream
+static instrs read_all(std::istream& in) {
+  stim_reader r(in);
+  instrs is{0, {}};
+  op o;
+  while (r.next(o)) {
+    is.ops.push_back(o);
+  }
+  is.n = r.n();
+  return is;
+}
+
+static int test_repeat() {
+  // The same circuit with nested REPEAT blocks, and unrolled:
+  const unsigned n = 5;
+  const std::string pre = stim_text(random_ops(n, 10, 13)),
+    a = stim_text(random_ops(n, 8, 14)), b = stim_text(random_ops(n, 6, 15)),
+    c = stim_text(random_ops(n, 4, 16)), post = stim_text(random_ops(n, 5, 17));
+  const std::string looped = pre +
+    "REPEAT 7 {\n" + a + "  REPEAT 3 {\n" + b + "  }\n" + c + "}\n" + post;
+  std::string unrolled = pre;
+  for (int i = 0; i < 7; i++) {
+    unrolled += a + b + b + b + c;
+  }
+  unrolled += post;
+
+  std::istringstream in0(unrolled), in1(looped);
+  const instrs is0 = read_all(in0), is1 = read_all(in1);
+  CHECK(is1.n == is0.n);
+  CHECK(is1.ops.size() < is0.ops.size());
+  CHECK(is1.ops[10].type == optype::Repeat);
+  CHECK(is1.ops[10].qubits[0] == 7);
+
+  const char* p = "simplex-test-repeat.bin";
+  write_binary_circuit(is1, p);
+  Simplex S0(is0, 4), S1(is1, 4), S3(p, 4);
+  std::remove(p);
+  std::istringstream in2(looped);
+  Simplex S2(in2, 4);
+  CHECK(S1.phase() == S0.phase());
+  CHECK(S2.phase() == S0.phase());
+  CHECK(S3.phase() == S0.phase());
+  for (unsigned j = 0; j < n; j++) {
+    const int m = S0.MeasZ(j, 0);
+    CHECK(S1.MeasZ(j, 0) == m);
+    CHECK(S2.MeasZ(j, 0) == m);
+    CHECK(S3.MeasZ(j, 0) == m);
+  }
+
+  const shot_results r0 = Simplex::sample(is0, 100, 9, 1);
+  const shot_results r1 = Simplex::sample(is1, 100, 9, 1);
+  CHECK(r1.n_meas == r0.n_meas);
+  CHECK(r1.data == r0.data);
+  CHECK(Sampler(is1).n_meas() == r0.n_meas);
+
+  // An unterminated block is an error:
+  std::istringstream in3("REPEAT 2 {\nH 0\n");
+  bool rejected = false;
+  try {
+    read_all(in3);
+  } catch (const std::invalid_argument&) {
+    rejected = true;
+  }
+  CHECK(rejected);
+  return 0;
+}
+
+static int test_files() {
+  const unsigned n = 5;
+  const std::string text = stim_text(random_ops(n, 50, 19));
+  std::istringstream in(text);
+  const instrs is0 = read_all(in);
+#if !defined(_WIN32)
+  // A pipe, which cannot be mapped, is read as a stream:
+  const char* p = "simplex-test-pipe";
+  std::remove(p);
+  CHECK(mkfifo(p, 0600) == 0);
+  std::thread writer([&] { std::ofstream(p) << text; });
+  const instrs is1 = parse_file(p);
+  writer.join();
+  CHECK(is1.n == is0.n);
+  CHECK(is1.ops.size() == is0.ops.size());
+  for (unsigned i = 0; i < is0.ops.size(); i++) {
+    CHECK(is1.ops[i].type == is0.ops[i].type);
+    CHECK(is1.ops[i].qubits == is0.ops[i].qubits);
+  }
+  // The simulator streams it, instead of reading it twice:
+  Simplex S0(is0, 3);
+  writer = std::thread([&] { std::ofstream(p) << text; });
+  Simplex S1(p, 3);
+  writer.join();
+  std::remove(p);
+  CHECK(S1.n() == n);
+  CHECK(S1.phase() == S0.phase());
+  for (unsigned j = 0; j < n; j++) {
+    CHECK(S1.MeasZ(j, 0) == S0.MeasZ(j, 0));
+  }
+#endif
+  // A missing file is an error:
+  bool rejected = false;
+  try {
+    parse_file("simplex-test-missing.stim");
+  } catch (const std::runtime_error&) {
+    rejected = true;
+  }
+  CHECK(rejected);
+  rejected = false;
+  try {
+    Simplex S("simplex-test-missing.stim");
+  } catch (const std::runtime_error&) {
+    rejected = true;
+  }
+  CHECK(rejected);
+  return 0;
+}
+
 int main() {
   CHECK_OK(test_X());
   CHECK_OK(test_Y());
@@ -2317,5 +2954,16 @@ int main() {
   CHECK_OK(test_phase());
   CHECK_OK(test_circ1());
   CHECK_OK(test_reset());
+  CHECK_OK(test_storage());
+  CHECK_OK(test_no_allocation());
+  CHECK_OK(test_copy_on_write());
+  CHECK_OK(test_sample());
+  CHECK_OK(test_sampler());
+  CHECK_OK(test_batch());
+  CHECK_OK(test_sample_all());
+  CHECK_OK(test_stream());
+  CHECK_OK(test_binary_circuit());
+  CHECK_OK(test_repeat());
+  CHECK_OK(test_files());
   return 0;
 }